@@ -13,4 +13,10 @@ function(link_root library_name)
     include(${ROOT_USE_FILE})
     target_link_libraries(${library_name} ${ROOT_LIBRARIES})
     include_directories(${CMAKE_CURRENT_SOURCE_DIR}/include)
+endfunction()
+
+# Find and link to the system thread library
+function(link_threads library_name)
+    find_package(Threads REQUIRED)
+    target_link_libraries(${library_name} ${CMAKE_THREAD_LIBS_INIT})
 endfunction()
\ No newline at end of file
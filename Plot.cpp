@@ -0,0 +1,12 @@
+// Plot.cpp
+//
+// Author: Matthew Dutson
+//
+// The entry point for the result plotting tool.
+
+#include "cherenkov_lib/ResultPlotter.h"
+
+int main(int argc, const char* argv[])
+{
+    return cherenkov_simulator::ResultPlotter::Run(argc, argv);
+}
@@ -0,0 +1,242 @@
+// Equivalence.cpp
+//
+// Author: Matthew Dutson
+//
+// Checks whether two simulation modes are statistically equivalent. Each mode is the base configuration with an
+// overlay applied (see Utility::ApplyOverlay), so an approximate fast path can be validated against the exact
+// simulation before it is used for a campaign.
+
+#include <algorithm>
+#include <iostream>
+#include <boost/property_tree/ptree.hpp>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TMath.h>
+
+#include "MonteCarlo.h"
+
+using namespace boost::property_tree;
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    /*
+     * The quantities compared between two modes, accumulated over every shower in the set.
+     */
+    struct ModeSamples
+    {
+        // The total noiseless signal and the number of pixels with a noiseless signal, for each simulated shower.
+        Double1D totals;
+        Double1D n_lit;
+
+        // The signal-weighted average arrival time of the photons of each shower with a noiseless signal.
+        Double1D centroids;
+
+        // The noiseless signal of each pixel, summed over every shower. Each shower fills a pixel once, with its signal
+        // as the weight, so the errors of the sums account for the variation between showers.
+        TH2D pixel_sums;
+
+        // Bin 1 counts untriggered showers, and bin 2 counts triggered showers.
+        TH1D triggers;
+
+        // Monocular reconstruction results of triggered showers (radians and cm).
+        Double1D psi;
+        Double1D r_p;
+
+        // The number of showers skipped because the simulation ran out of memory.
+        int n_skipped = 0;
+    };
+
+    /*
+     * Simulates the same seeded showers with the specified configuration. Showers are generated by the reference
+     * MonteCarlo so that both modes see identical showers, and the noise of each shower is seeded independently of the
+     * simulation so that differences can only come from the simulation itself.
+     */
+    ModeSamples Collect(const ptree& config, const MonteCarlo& generator, int n_showers, unsigned int seed, string name)
+    {
+        Simulator simulator = Simulator(config);
+        Reconstructor reconstructor = Reconstructor(config);
+
+        ModeSamples samples = ModeSamples();
+        samples.triggers = TH1D((name + "_triggers").c_str(), "Triggers", 2, 0, 2);
+        samples.triggers.SetDirectory(nullptr);
+        auto n_pixels = (int) Simulator::MakeCountParams(config).n_pixels;
+        samples.pixel_sums = TH2D((name + "_pixel_sums").c_str(), "Pixel Sums", n_pixels, 0, n_pixels, n_pixels, 0,
+                                  n_pixels);
+        samples.pixel_sums.SetDirectory(nullptr);
+        samples.pixel_sums.Sumw2();
+        for (int i = 0; i < n_showers; i++)
+        {
+            Utility::Rng().SetSeed(seed + i);
+            Shower shower = generator.GenerateShower();
+            PhotonCount data;
+            try
+            {
+                data = simulator.SimulateShower(shower);
+            }
+            catch (out_of_range&)
+            {
+                samples.n_skipped++;
+                continue;
+            }
+
+            // Pixels of the same shower are correlated, so apart from the pixel sums the tests compare one value per
+            // shower rather than pooling the pixels of every shower.
+            double total = 0;
+            double time_sum = 0;
+            int n_lit = 0;
+            PhotonCount::Iterator iter = data.GetIterator();
+            while (iter.Next())
+            {
+                int sum = data.SumBins(iter);
+                if (sum == 0) continue;
+                total += sum;
+                time_sum += sum * data.AverageTime(iter);
+                samples.pixel_sums.Fill(iter.X(), iter.Y(), sum);
+                n_lit++;
+            }
+            samples.totals.push_back(total);
+            samples.n_lit.push_back(n_lit);
+            if (total > 0) samples.centroids.push_back(time_sum / total);
+
+            // As in MonteCarlo, showers which leave no signal are counted as untriggered.
+            if (data.Empty())
+            {
+                samples.triggers.Fill(0);
+                continue;
+            }
+            Utility::Rng().SetSeed(seed + n_showers + i);
+            reconstructor.AddNoise(data);
+            reconstructor.ClearNoise(data);
+            Reconstructor::Result result = reconstructor.Reconstruct(data);
+            samples.triggers.Fill(result.triggered ? 1 : 0);
+            if (!result.triggered) continue;
+            samples.psi.push_back(result.mono_recon.ImpactAngle());
+            samples.r_p.push_back(result.mono_recon.ImpactParam());
+        }
+        return samples;
+    }
+
+    /*
+     * Performs a two-sample Kolmogorov-Smirnov test. Returns -1 if either sample is empty.
+     */
+    double KSTest(Double1D a, Double1D b)
+    {
+        if (a.empty() || b.empty()) return -1;
+        sort(a.begin(), a.end());
+        sort(b.begin(), b.end());
+        return TMath::KolmogorovTest((int) a.size(), &a[0], (int) b.size(), &b[0], "");
+    }
+
+    /*
+     * Performs a two-sample chi-square test of discrete values, which the Kolmogorov-Smirnov test can't handle since
+     * it assumes there are no ties. The values of both samples are pooled and split into up to n_bins bins with
+     * roughly equal counts, keeping equal values in the same bin. Returns -1 if either sample is empty, and 1 if every
+     * value is the same.
+     */
+    double Chi2Test(Double1D a, Double1D b, string name, int n_bins = 10)
+    {
+        if (a.empty() || b.empty()) return -1;
+        Double1D pooled = a;
+        pooled.insert(pooled.end(), b.begin(), b.end());
+        sort(pooled.begin(), pooled.end());
+        if (pooled.front() == pooled.back()) return 1;
+
+        // The last bin ends one unit above the largest value, so that it falls inside the histogram.
+        Double1D edges = {pooled.front()};
+        for (int i = 1; i < n_bins; i++)
+        {
+            double edge = pooled[pooled.size() * i / n_bins];
+            if (edge > edges.back()) edges.push_back(edge);
+        }
+        if (edges.size() == 1) edges.push_back(*upper_bound(pooled.begin(), pooled.end(), pooled.front()));
+        edges.push_back(pooled.back() + 1);
+
+        TH1D histo_a = TH1D((name + "_a").c_str(), "", (int) edges.size() - 1, &edges[0]);
+        TH1D histo_b = TH1D((name + "_b").c_str(), "", (int) edges.size() - 1, &edges[0]);
+        histo_a.SetDirectory(nullptr);
+        histo_b.SetDirectory(nullptr);
+        for (double value : a)
+            histo_a.Fill(value);
+        for (double value : b)
+            histo_b.Fill(value);
+        return histo_a.Chi2Test(&histo_b, "UU");
+    }
+
+    /*
+     * Prints the number of showers of a mode which were skipped as a line of JSON. These showers are missing from
+     * every test of the mode, so a difference between modes is worth checking even if the tests pass.
+     */
+    void ReportSkipped(string mode, const ModeSamples& samples, int n_showers)
+    {
+        cout << "{\"mode\": \"" << mode << "\", \"showers\": " << n_showers << ", \"skipped\": " << samples.n_skipped
+             << "}" << endl;
+    }
+
+    /*
+     * Prints the p-value of a test as a line of JSON. Returns false if the test failed. Skipped tests (negative
+     * p-values) don't fail.
+     */
+    bool Report(string test, string method, double p_value, double alpha)
+    {
+        string status = p_value < 0 ? "skipped" : (p_value < alpha ? "fail" : "pass");
+        cout << "{\"test\": \"" << test << "\", \"method\": \"" << method << "\", \"p_value\": " << p_value
+             << ", \"alpha\": " << alpha << ", \"status\": \"" << status << "\"}" << endl;
+        return status != "fail";
+    }
+}
+
+using namespace cherenkov_simulator;
+
+/*
+ * Usage: cherenkov_equiv <config file> <reference overlay> <candidate overlay> [n_showers] [alpha] [seed]. An overlay
+ * is an XML file with the same structure as the config file, containing only the entries to change. Pass "-" to use
+ * the base configuration unchanged.
+ */
+int main(int argc, const char* argv[])
+{
+    if (argc < 4)
+    {
+        cout << "Usage: cherenkov_equiv <config file> <reference overlay> <candidate overlay> [n_showers] [alpha] "
+                "[seed]" << endl;
+        return -1;
+    }
+    int n_showers = argc > 4 ? stoi(argv[4]) : 100;
+    double alpha = argc > 5 ? stod(argv[5]) : 0.01;
+    unsigned int seed = argc > 6 ? (unsigned int) stoul(argv[6]) : 1;
+
+    try
+    {
+        ptree base = Utility::ParseXMLFile(argv[1]).get_child("config");
+        vector<ptree> configs = vector<ptree>();
+        for (int i = 2; i <= 3; i++)
+        {
+            ptree config = base;
+            if (string(argv[i]) != "-")
+                Utility::ApplyOverlay(config, Utility::ParseXMLFile(argv[i]).get_child("config"));
+            configs.push_back(config);
+        }
+
+        MonteCarlo generator = MonteCarlo(configs[0]);
+        ModeSamples ref = Collect(configs[0], generator, n_showers, seed, "reference");
+        ModeSamples cand = Collect(configs[1], generator, n_showers, seed, "candidate");
+
+        ReportSkipped("reference", ref, n_showers);
+        ReportSkipped("candidate", cand, n_showers);
+        bool passed = true;
+        passed &= Report("pixel_sums", "chi2", ref.pixel_sums.Chi2Test(&cand.pixel_sums, "WW"), alpha);
+        passed &= Report("shower_totals", "chi2", Chi2Test(ref.totals, cand.totals, "totals"), alpha);
+        passed &= Report("lit_pixels", "chi2", Chi2Test(ref.n_lit, cand.n_lit, "lit_pixels"), alpha);
+        passed &= Report("time_centroids", "ks", KSTest(ref.centroids, cand.centroids), alpha);
+        passed &= Report("triggers", "chi2", ref.triggers.Chi2Test(&cand.triggers, "UU"), alpha);
+        passed &= Report("mono_psi", "ks", KSTest(ref.psi, cand.psi), alpha);
+        passed &= Report("mono_r_p", "ks", KSTest(ref.r_p, cand.r_p), alpha);
+        cout << (passed ? "PASS" : "FAIL") << endl;
+        return passed ? 0 : 1;
+    }
+    catch (runtime_error& err)
+    {
+        cout << err.what() << endl;
+        return -1;
+    }
+}
@@ -0,0 +1,273 @@
+// HotPaths.cpp
+//
+// Author: Matthew Dutson
+//
+// Micro-benchmarks of the most expensive steps of simulation and reconstruction. Each benchmark prints a single line
+// of JSON to stdout so results can be collected and compared between builds.
+
+#include <chrono>
+#include <iostream>
+#include <boost/property_tree/ptree.hpp>
+
+#include "MonteCarlo.h"
+#include "Reconstructor.h"
+#include "Simulator.h"
+
+using namespace boost::property_tree;
+using namespace std;
+using namespace TMath;
+
+namespace cherenkov_simulator
+{
+    /*
+     * Runs each benchmark on the sample showers of SampleEvents.cpp, starting from a fixed seed for each shower. Has
+     * friend access to the Simulator and Reconstructor so that private steps can be timed in isolation.
+     */
+    class HotPaths
+    {
+    public:
+
+        HotPaths(const ptree& config, int n_repeats) : monte_carlo(config), simulator(config), reconstructor(config)
+        {
+            this->n_repeats = n_repeats;
+        }
+
+        /*
+         * Runs every benchmark on every sample shower.
+         */
+        void RunAll()
+        {
+            RunShower("straight_shower", 1001, TVector3(0, 0, -1), 1e6, 0);
+            RunShower("typical_shower", 1002, TVector3(1, 1, -3), 1e6, -0.1);
+            RunShower("distant_shower", 1003, TVector3(0, 0, -1), 3e6, 0);
+        }
+
+    private:
+
+        typedef chrono::steady_clock Clock;
+
+        // The number of photons generated at each depth step for the optics benchmarks.
+        static const int photons_per_step = 100;
+
+        // The number of photons added in the AddPhoton benchmark.
+        static const int n_add_photon = 1000000;
+
+        int n_repeats;
+        MonteCarlo monte_carlo;
+        Simulator simulator;
+        Reconstructor reconstructor;
+
+        /*
+         * Runs every benchmark on a 1e19 eV shower with the specified geometry.
+         */
+        void RunShower(string name, unsigned int seed, TVector3 axis, double im_par, double im_ang)
+        {
+            Utility::Rng().SetSeed(seed);
+            Shower shower = monte_carlo.GenerateShower(axis, im_par, im_ang, 1e19);
+            BenchOptics(name, shower);
+            BenchAddPhoton(name, shower);
+            BenchNoise(name, shower);
+            BenchEvent(name, shower);
+        }
+
+        /*
+         * Traces fluorescence and Cherenkov photons from along the shower track through the detector optics.
+         */
+        void BenchOptics(string name, Shower shower)
+        {
+            vector<Ray> flor_photons = vector<Ray>();
+            vector<Ray> chkv_photons = vector<Ray>();
+            Shower track = shower;
+            while (track.TimeToPlane(simulator.ground_plane) > 0)
+            {
+                track.IncrementDepth(simulator.depth_step);
+                for (int i = 0; i < photons_per_step; i++)
+                {
+                    TVector3 lens_impact = simulator.rot_to_world * simulator.RandomStopImpact();
+                    Ray photon = simulator.JitteredRay(track, lens_impact - track.Position());
+                    photon.PropagateToPoint(lens_impact);
+                    flor_photons.push_back(photon);
+
+                    photon = simulator.GenerateCherenkovPhoton(track);
+                    photon.PropagateToPlane(simulator.ground_plane);
+                    photon.PropagateToPoint(simulator.rot_to_world * simulator.RandomStopImpact());
+                    chkv_photons.push_back(photon);
+                }
+            }
+
+            for (auto& photons : {make_pair(string("SimulateOptics/fluorescence"), &flor_photons),
+                                  make_pair(string("SimulateOptics/cherenkov"), &chkv_photons)})
+            {
+                double seconds = 0;
+                for (int i = 0; i < n_repeats; i++)
+                {
+                    PhotonCount data = MakePhotonCount(shower);
+                    Clock::time_point start = Clock::now();
+                    for (const Ray& photon : *photons.second)
+                        simulator.SimulateOptics(photon, data, 1);
+                    seconds += Seconds(start);
+                }
+                Report(photons.first, name, seconds, (double) n_repeats * photons.second->size(), "ns/photon");
+            }
+        }
+
+        /*
+         * Adds photons at random positions on the camera and random times within the shower's time window.
+         */
+        void BenchAddPhoton(string name, Shower shower)
+        {
+            double min_time = simulator.MinTime(shower);
+            double max_time = simulator.MaxTime(shower);
+            vector<pair<double, TVector3>> photons = vector<pair<double, TVector3>>();
+            for (int i = 0; i < n_add_photon; i++)
+            {
+                double r = Utility::RandLinear(0.0, simulator.pmtclust_size / 2.0);
+                double phi = Utility::Rng().Uniform(TwoPi());
+                TVector3 position = TVector3(r * Cos(phi), r * Sin(phi), -simulator.mirror_radius / 2.0);
+                photons.emplace_back(Utility::Rng().Uniform(min_time, max_time), position);
+            }
+
+            double seconds = 0;
+            for (int i = 0; i < n_repeats; i++)
+            {
+                PhotonCount data = MakePhotonCount(shower);
+                Clock::time_point start = Clock::now();
+                for (const auto& photon : photons)
+                    data.AddPhoton(photon.first, photon.second, 1);
+                seconds += Seconds(start);
+            }
+            Report("PhotonCount::AddPhoton", name, seconds, (double) n_repeats * photons.size(), "ns/photon");
+        }
+
+        /*
+         * Adds ground-level noise to every pixel of an empty PhotonCount covering the shower's time window, once with
+         * every bin drawn and once with only the nonzero bins drawn.
+         */
+        void BenchNoise(string name, Shower shower)
+        {
+            double dense_time = 0, sparse_time = 0, n_cells = 0;
+            for (int i = 0; i < n_repeats; i++)
+            {
+                PhotonCount dense = MakePhotonCount(shower);
+                PhotonCount sparse = dense;
+                n_cells += Sq((double) dense.Size()) * dense.NBins();
+
+                Clock::time_point start = Clock::now();
+                PhotonCount::Iterator iter = dense.GetIterator();
+                while (iter.Next()) dense.AddNoise(reconstructor.gnd_noise, iter);
+                dense_time += Seconds(start);
+
+                start = Clock::now();
+                iter = sparse.GetIterator();
+                while (iter.Next()) sparse.AddSparseNoise(reconstructor.gnd_noise, iter);
+                sparse_time += Seconds(start);
+            }
+            Report("PhotonCount::AddNoise", name, dense_time, n_cells, "ns/pixel-bin");
+            Report("PhotonCount::AddSparseNoise", name, sparse_time, n_cells, "ns/pixel-bin");
+        }
+
+        /*
+         * Simulates the shower once, then times each step of noise handling and reconstruction on copies of the
+         * result. Triggering is timed on the cleared signal, as in Reconstruct. Fits are only timed for the repeats
+         * which trigger, and their rates are per triggered repeat.
+         */
+        void BenchEvent(string name, Shower shower)
+        {
+            Clock::time_point start = Clock::now();
+            PhotonCount original = simulator.SimulateShower(shower);
+            Report("SimulateShower", name, Seconds(start), 1, "events/s");
+            if (original.Empty()) return;
+
+            double n_cells = Sq((double) original.Size()) * original.NBins() * n_repeats;
+            double noise_time = 0, clear_time = 0, trig_time = 0, plane_time = 0, mono_time = 0, recon_time = 0;
+            int n_triggered = 0;
+            for (int i = 0; i < n_repeats; i++)
+            {
+                PhotonCount data = original;
+                start = Clock::now();
+                reconstructor.AddNoise(data);
+                noise_time += Seconds(start);
+
+                start = Clock::now();
+                reconstructor.ClearNoise(data);
+                clear_time += Seconds(start);
+
+                start = Clock::now();
+                reconstructor.GetTriggeringState(data);
+                trig_time += Seconds(start);
+
+                start = Clock::now();
+                bool triggered = reconstructor.Reconstruct(data).triggered;
+                recon_time += Seconds(start);
+                if (!triggered) continue;
+                n_triggered++;
+
+                start = Clock::now();
+                TRotation to_sdp = reconstructor.FitSDPlane(data);
+                plane_time += Seconds(start);
+
+                start = Clock::now();
+                reconstructor.MonocularFit(data, to_sdp);
+                mono_time += Seconds(start);
+            }
+            Report("Reconstructor::AddNoise", name, noise_time, n_cells, "ns/pixel-bin");
+            Report("Reconstructor::ClearNoise", name, clear_time, n_cells, "ns/pixel-bin");
+            Report("Reconstructor::GetTriggeringState", name, trig_time, n_cells, "ns/pixel-bin");
+            Report("Reconstructor::Reconstruct", name, recon_time, n_repeats, "events/s");
+            if (n_triggered == 0) return;
+            Report("Reconstructor::FitSDPlane", name, plane_time, n_triggered, "events/s");
+            Report("Reconstructor::MonocularFit", name, mono_time, n_triggered, "events/s");
+        }
+
+        /*
+         * Creates an empty PhotonCount covering the time window of the shower.
+         */
+        PhotonCount MakePhotonCount(Shower shower) const
+        {
+            return PhotonCount(simulator.count_params, simulator.MinTime(shower), simulator.MaxTime(shower));
+        }
+
+        /*
+         * Returns the number of seconds since the specified time.
+         */
+        static double Seconds(Clock::time_point start)
+        {
+            return chrono::duration<double>(Clock::now() - start).count();
+        }
+
+        /*
+         * Prints a line of JSON describing the result of a benchmark. Per-item units are reported in nanoseconds and
+         * rates (events/s) in items per second.
+         */
+        static void Report(string bench, string shower, double seconds, double count, string unit)
+        {
+            double value = unit == "events/s" ? count / seconds : seconds * 1e9 / count;
+            cout << "{\"bench\": \"" << bench << "\", \"shower\": \"" << shower << "\", \"value\": " << value
+                 << ", \"unit\": \"" << unit << "\", \"count\": " << count << ", \"seconds\": " << seconds << "}"
+                 << endl;
+        }
+    };
+}
+
+using namespace cherenkov_simulator;
+
+/*
+ * Takes an optional configuration file (Config.xml in the parent directory by default) and an optional number of
+ * repetitions of each benchmark (5 by default).
+ */
+int main(int argc, const char* argv[])
+{
+    string config_file = argc > 1 ? argv[1] : "../Config.xml";
+    int n_repeats = argc > 2 ? stoi(argv[2]) : 5;
+    try
+    {
+        ptree config = Utility::ParseXMLFile(config_file).get_child("config");
+        HotPaths(config, n_repeats).RunAll();
+        return 0;
+    }
+    catch (runtime_error& err)
+    {
+        cout << err.what() << endl;
+        return -1;
+    }
+}
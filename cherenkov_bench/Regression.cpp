@@ -0,0 +1,174 @@
+// Regression.cpp
+//
+// Author: Matthew Dutson
+//
+// Runs a fixed set of seeded showers through the full simulation and reconstruction pipeline and compares the wall
+// time, photon tracing rate, and peak memory against a stored baseline. Returns a nonzero exit code if any metric is
+// worse than the baseline by more than its tolerance, or has no baseline.
+
+#include <chrono>
+#include <iostream>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include "MonteCarlo.h"
+
+using namespace boost::property_tree;
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    /*
+     * A single regression metric. If higher_better is false, larger values are regressions.
+     */
+    struct Metric
+    {
+        string name;
+        double value;
+        bool higher_better;
+    };
+
+    /*
+     * Runs every combination of energy and sample geometry with a fixed seed, and returns the metrics of the run.
+     */
+    vector<Metric> RunShowers(const ptree& config)
+    {
+        // Plots aren't part of the benchmark.
+        ptree bench_config = config;
+        bench_config.put("simulation.diagnostics", "none");
+        MonteCarlo monte_carlo = MonteCarlo(bench_config);
+
+        struct Geometry
+        {
+            string name;
+            TVector3 axis;
+            double im_par;
+            double im_ang;
+        };
+        vector<Geometry> geometries = {{"straight", TVector3(0, 0, -1), 1e6, 0},
+                                       {"typical", TVector3(1, 1, -3), 1e6, -0.1},
+                                       {"distant", TVector3(0, 0, -1), 3e6, 0}};
+        vector<double> energies = {1e17, 1e18, 1e19, 1e20, 1e21};
+
+        ShowerProfile total = ShowerProfile();
+        unsigned int seed = 1;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (const Geometry& geometry : geometries)
+        {
+            for (double energy : energies)
+            {
+                Utility::Rng().SetSeed(seed++);
+                Shower shower = monte_carlo.GenerateShower(geometry.axis, geometry.im_par, geometry.im_ang, energy);
+                PlotList plots = PlotList();
+                ShowerProfile profile = ShowerProfile();
+                monte_carlo.RunSingleShower(shower, geometry.name, plots, nullptr, &profile);
+                total.Add(profile);
+            }
+        }
+        double wall_time = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        double n_photons = total.funnel.Total(PhotonFunnel::fluorescence) + total.funnel.Total(PhotonFunnel::cherenkov);
+
+        // On Linux, ru_maxrss is reported in kilobytes.
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return {{"wall_time", wall_time, false},
+                {"photons_per_second", n_photons / wall_time, true},
+                {"peak_memory_kb", (double) usage.ru_maxrss, false}};
+    }
+
+    /*
+     * Returns a description of the machine running the benchmark, which is stored with a recorded baseline.
+     */
+    string MachineName()
+    {
+        utsname name;
+        if (uname(&name) != 0) return "unknown";
+        return string(name.nodename) + " (" + name.sysname + " " + name.release + ", " + name.machine + ")";
+    }
+
+    /*
+     * Compares each metric against the baseline and prints the result as a line of JSON, after a line naming the
+     * machines which recorded the baseline and ran the benchmark. Returns true if every metric has a baseline and none
+     * regressed beyond its tolerance.
+     */
+    bool CompareToBaseline(const vector<Metric>& metrics, const ptree& baseline)
+    {
+        cout << "{\"baseline_machine\": \"" << baseline.get<string>("machine", "") << "\", \"machine\": \""
+             << MachineName() << "\"}" << endl;
+        bool passed = true;
+        for (const Metric& metric : metrics)
+        {
+            boost::optional<double> expected = baseline.get_optional<double>("metrics." + metric.name);
+            double tolerance = baseline.get<double>("tolerance." + metric.name, 0.1);
+            string status = "no_baseline";
+            double change = 0;
+            if (!expected || *expected <= 0)
+            {
+                passed = false;
+            }
+            else
+            {
+                change = (metric.value - *expected) / *expected;
+                bool regressed = metric.higher_better ? change < -tolerance : change > tolerance;
+                status = regressed ? "regressed" : "ok";
+                passed = passed && !regressed;
+            }
+            cout << "{\"metric\": \"" << metric.name << "\", \"value\": " << metric.value << ", \"baseline\": "
+                 << (expected ? *expected : 0) << ", \"change\": " << change << ", \"tolerance\": " << tolerance
+                 << ", \"status\": \"" << status << "\"}" << endl;
+        }
+        if (!passed) cerr << "Metrics without a baseline can be recorded with --record" << endl;
+        return passed;
+    }
+}
+
+using namespace cherenkov_simulator;
+
+/*
+ * Usage: cherenkov_regress [--record] <baseline file> [config file]. With --record, the metrics of this run and the
+ * name of this machine replace those in the baseline file, keeping its tolerances. Without it, a baseline with no
+ * metrics is a failure, since there would be nothing to compare against.
+ */
+int main(int argc, const char* argv[])
+{
+    vector<string> args = vector<string>();
+    bool record = false;
+    for (int i = 1; i < argc; i++)
+    {
+        if (string(argv[i]) == "--record") record = true;
+        else args.push_back(string(argv[i]));
+    }
+    if (args.empty())
+    {
+        cout << "Usage: cherenkov_regress [--record] <baseline file> [config file]" << endl;
+        return -1;
+    }
+    string baseline_file = args[0];
+    string config_file = args.size() > 1 ? args[1] : "../Config.xml";
+
+    try
+    {
+        ptree baseline = ptree();
+        read_json(baseline_file, baseline);
+        ptree config = Utility::ParseXMLFile(config_file).get_child("config");
+        vector<Metric> metrics = RunShowers(config);
+        if (record)
+        {
+            baseline.erase("metrics");
+            for (const Metric& metric : metrics)
+                baseline.put("metrics." + metric.name, metric.value);
+            baseline.put("machine", MachineName());
+            write_json(baseline_file, baseline);
+            cout << "Recorded a new baseline in " << baseline_file << endl;
+            return 0;
+        }
+        return CompareToBaseline(metrics, baseline) ? 0 : 1;
+    }
+    catch (runtime_error& err)
+    {
+        cout << err.what() << endl;
+        return -1;
+    }
+}
@@ -37,6 +37,23 @@ namespace cherenkov_simulator
         return histo;
     }
 
+    TH2I Analysis::MakeFunnelPlot(const PhotonFunnel& funnel, string name)
+    {
+        int n_outcomes = PhotonFunnel::n_outcomes;
+        int n_sources = PhotonFunnel::n_sources;
+        TH2I histo = TH2I(name.c_str(), "Photon Funnel", n_outcomes, 0, n_outcomes, n_sources, 0, n_sources);
+        for (int i = 0; i < n_outcomes; i++)
+            histo.GetXaxis()->SetBinLabel(i + 1, PhotonFunnel::Name(i).c_str());
+        histo.GetYaxis()->SetBinLabel(1, "Fluorescence");
+        histo.GetYaxis()->SetBinLabel(2, "Cherenkov");
+
+        // The zeroth bin is the underflow, so start at 1.
+        for (int i = 0; i < n_sources; i++)
+            for (int j = 0; j < n_outcomes; j++)
+                histo.SetBinContent(j + 1, i + 1, funnel.counts[i][j]);
+        return histo;
+    }
+
     TH2C Analysis::GetValidMap(const PhotonCount& data)
     {
         return GetBooleanMap(data.GetValid());
@@ -8,16 +8,24 @@
 #ifndef ANALYSIS_H
 #define ANALYSIS_H
 
+#include <memory>
+#include <utility>
 #include <vector>
 #include <TGraph.h>
 #include <TH2.h>
 
 #include "DataStructures.h"
 #include "Geometric.h"
+#include "Profiler.h"
 #include "Utility.h"
 
 namespace cherenkov_simulator
 {
+    /*
+     * A collection of ROOT objects, each paired with the name it should be written under.
+     */
+    typedef std::vector<std::pair<std::string, std::unique_ptr<TObject>>> PlotList;
+
     /*
      * Defines miscellaneous static methods for visualizing the results of a simulation.
      */
@@ -35,6 +43,11 @@ namespace cherenkov_simulator
          */
         static TH2I MakePixlProfile(const PhotonCount& data, std::string name, bool reverse_y = true);
 
+        /*
+         * Makes a 2D histogram of the number of photons with each outcome (x) from each source (y).
+         */
+        static TH2I MakeFunnelPlot(const PhotonFunnel& funnel, std::string name);
+
         /*
          * Creates a 2D histogram with a 1 for valid cells and a 0 for invalid cells.
          */
@@ -0,0 +1,112 @@
+// BufferPool.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of BufferPool.h
+
+#include <atomic>
+
+#include "BufferPool.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    namespace
+    {
+        // Set when either pool of a thread is destroyed. Being trivially destructible, it can still be read by
+        // destructors which run after the pools are gone.
+        thread_local bool pools_destroyed = false;
+
+        atomic<size_t> n_hits(0);
+
+        template<class Cube>
+        struct ThreadPool
+        {
+            vector<Cube> cubes;
+
+            ~ThreadPool()
+            {
+                pools_destroyed = true;
+            }
+        };
+    }
+
+    Short3D BufferPool::TakeCounts(size_t n_pixels, size_t n_bins)
+    {
+        return Take(CountsPool(), n_pixels, n_bins, (short) 0);
+    }
+
+    void BufferPool::GiveCounts(Short3D&& cube)
+    {
+        Give(CountsPool(), move(cube));
+    }
+
+    Bool3D BufferPool::TakeMask(size_t n_pixels, size_t n_bins)
+    {
+        return Take(MaskPool(), n_pixels, n_bins, false);
+    }
+
+    void BufferPool::GiveMask(Bool3D&& mask)
+    {
+        Give(MaskPool(), move(mask));
+    }
+
+    size_t BufferPool::NPooled()
+    {
+        size_t n_counts = CountsPool() == nullptr ? 0 : CountsPool()->size();
+        size_t n_masks = MaskPool() == nullptr ? 0 : MaskPool()->size();
+        return n_counts + n_masks;
+    }
+
+    size_t BufferPool::NHits()
+    {
+        return n_hits.load();
+    }
+
+    vector<Short3D>* BufferPool::CountsPool()
+    {
+        if (pools_destroyed) return nullptr;
+        static thread_local ThreadPool<Short3D> pool;
+        return &pool.cubes;
+    }
+
+    vector<Bool3D>* BufferPool::MaskPool()
+    {
+        if (pools_destroyed) return nullptr;
+        static thread_local ThreadPool<Bool3D> pool;
+        return &pool.cubes;
+    }
+
+    template<class Cube, class Value>
+    Cube BufferPool::Take(vector<Cube>* pool, size_t n_pixels, size_t n_bins, Value value)
+    {
+        Cube cube = Cube();
+        if (pool != nullptr && !pool->empty())
+        {
+            auto match = pool->end() - 1;
+            for (auto it = pool->begin(); it != pool->end(); it++)
+                if (it->size() == n_pixels) match = it;
+            cube = move(*match);
+            pool->erase(match);
+            n_hits++;
+        }
+
+        // Resizing and assigning in place keeps the capacity of each time series.
+        cube.resize(n_pixels);
+        for (auto& row : cube)
+        {
+            row.resize(n_pixels);
+            for (auto& series : row)
+                series.assign(n_bins, value);
+        }
+        return cube;
+    }
+
+    template<class Cube>
+    void BufferPool::Give(vector<Cube>* pool, Cube&& cube)
+    {
+        if (pool == nullptr || cube.empty() || pool->size() >= max_pooled) return;
+        pool->push_back(move(cube));
+    }
+}
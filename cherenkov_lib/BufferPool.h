@@ -0,0 +1,86 @@
+// BufferPool.h
+//
+// Author: Matthew Dutson
+//
+// Definition of BufferPool, which recycles the count cubes and masks used for each shower
+
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <vector>
+
+#include "Utility.h"
+
+namespace cherenkov_simulator
+{
+    /*
+     * Keeps the (pixel, pixel, time bin) cubes of finished showers so that later showers can reuse their memory. A
+     * cube taken from the pool is reshaped in place, which only allocates if it has fewer pixels or less capacity per
+     * pixel than requested, so once a worker has seen its largest shower it stops allocating cubes. Each thread has
+     * its own pool, so no locking is needed, and cubes can be given back on a different thread than they were taken.
+     * Pooled cubes keep their memory until the thread exits, so threads which simulate showers should live for the
+     * whole run (see WorkerPool) rather than one shower. Cubes may be given back after the pools of their thread have
+     * been destroyed, for example by a PhotonCount with static storage, which is destroyed after every thread_local
+     * object of the main thread. Such cubes are freed rather than pooled.
+     */
+    class BufferPool
+    {
+    public:
+
+        /*
+         * Returns a cube of photon counts with every bin set to zero.
+         */
+        static Short3D TakeCounts(size_t n_pixels, size_t n_bins);
+
+        /*
+         * Returns a cube of photon counts to the pool. Empty cubes, and cubes beyond the pool size, are freed.
+         */
+        static void GiveCounts(Short3D&& cube);
+
+        /*
+         * Returns a mask with every bin set to false.
+         */
+        static Bool3D TakeMask(size_t n_pixels, size_t n_bins);
+
+        /*
+         * Returns a mask to the pool. Empty masks, and masks beyond the pool size, are freed.
+         */
+        static void GiveMask(Bool3D&& mask);
+
+        /*
+         * The number of cubes of each type currently pooled by this thread.
+         */
+        static size_t NPooled();
+
+        /*
+         * The number of cubes which were taken from a pool rather than allocated, summed over every thread.
+         */
+        static size_t NHits();
+
+    private:
+
+        // The most cubes of each type kept by a thread. A shower needs at most a few counts and masks at once.
+        static const size_t max_pooled = 4;
+
+        /*
+         * The pools of the calling thread, or null once the thread has started destroying them.
+         */
+        static std::vector<Short3D>* CountsPool();
+        static std::vector<Bool3D>* MaskPool();
+
+        /*
+         * Removes a cube from the pool, preferring one with the requested number of pixels, and reshapes it with every
+         * bin set to the specified value. Constructs a new cube if the pool is empty or null.
+         */
+        template<class Cube, class Value>
+        static Cube Take(std::vector<Cube>* pool, size_t n_pixels, size_t n_bins, Value value);
+
+        /*
+         * Adds a cube to the pool if it isn't empty and the pool isn't full or null.
+         */
+        template<class Cube>
+        static void Give(std::vector<Cube>* pool, Cube&& cube);
+    };
+}
+
+#endif
@@ -4,9 +4,12 @@
 //
 // Implementation of DataStructures.h
 
+#include <algorithm>
+#include <cmath>
 #include <TMath.h>
 #include <TRandom3.h>
 
+#include "BufferPool.h"
 #include "DataStructures.h"
 
 using namespace std;
@@ -66,9 +69,15 @@ namespace cherenkov_simulator
     PhotonCount::PhotonCount()
     {
         n_pixels = 0;
+        ang_size = 0;
+        lin_size = 0;
+        bin_size = 0;
         min_time = 0;
         max_time = 0;
+        frst_time = 0;
+        last_time = 0;
         empty = true;
+        trimd = false;
     }
 
     PhotonCount::PhotonCount(Params params, double min_time, double max_time)
@@ -96,7 +105,7 @@ namespace cherenkov_simulator
         if (NBins() * Sq(n_pixels) * sizeof(short) > params.max_byte)
             throw out_of_range("Warning: too much memory requested due to shower direction");
 
-        counts = Short3D(Size(), Short2D(Size(), Short1D(NBins(), 0)));
+        counts = BufferPool::TakeCounts(Size(), NBins());
         sums = Short2D(Size(), Short1D(Size(), 0));
         valid = Bool2D(Size(), Bool1D(Size(), false));
         for (int i = 0; i < Size(); i++)
@@ -104,6 +113,64 @@ namespace cherenkov_simulator
                 valid[i][j] = IsValid(i, j);
     }
 
+    PhotonCount::PhotonCount(const PhotonCount& other) : PhotonCount()
+    {
+        *this = other;
+    }
+
+    PhotonCount& PhotonCount::operator=(const PhotonCount& other)
+    {
+        if (this == &other) return *this;
+
+        // Copying each time series into a cube of the same shape reuses memory which is already there. Since cubes are
+        // square, a cube with the same number of rows has the same shape.
+        if (counts.size() != other.counts.size())
+        {
+            BufferPool::GiveCounts(move(counts));
+            counts = other.counts.empty() ? Short3D() : BufferPool::TakeCounts(other.counts.size(), 0);
+        }
+        for (size_t i = 0; i < counts.size(); i++)
+            for (size_t j = 0; j < counts[i].size(); j++)
+                counts[i][j].assign(other.counts[i][j].begin(), other.counts[i][j].end());
+
+        sums = other.sums;
+        valid = other.valid;
+        n_pixels = other.n_pixels;
+        ang_size = other.ang_size;
+        lin_size = other.lin_size;
+        bin_size = other.bin_size;
+        min_time = other.min_time;
+        max_time = other.max_time;
+        frst_time = other.frst_time;
+        last_time = other.last_time;
+        empty = other.empty;
+        trimd = other.trimd;
+        return *this;
+    }
+
+    PhotonCount& PhotonCount::operator=(PhotonCount&& other)
+    {
+        swap(counts, other.counts);
+        swap(sums, other.sums);
+        swap(valid, other.valid);
+        swap(n_pixels, other.n_pixels);
+        swap(ang_size, other.ang_size);
+        swap(lin_size, other.lin_size);
+        swap(bin_size, other.bin_size);
+        swap(min_time, other.min_time);
+        swap(max_time, other.max_time);
+        swap(frst_time, other.frst_time);
+        swap(last_time, other.last_time);
+        swap(empty, other.empty);
+        swap(trimd, other.trimd);
+        return *this;
+    }
+
+    PhotonCount::~PhotonCount()
+    {
+        BufferPool::GiveCounts(move(counts));
+    }
+
     Bool2D PhotonCount::GetValid() const
     {
         return valid;
@@ -119,6 +186,16 @@ namespace cherenkov_simulator
         return min_time == max_time ? 0 : Bin(max_time) + 1;
     }
 
+    double PhotonCount::BinSize() const
+    {
+        return bin_size;
+    }
+
+    double PhotonCount::AngSize() const
+    {
+        return ang_size;
+    }
+
     bool PhotonCount::Empty() const
     {
         return empty;
@@ -197,14 +274,14 @@ namespace cherenkov_simulator
 
     Bool3D PhotonCount::GetFalseMatrix() const
     {
-        return Bool3D(Size(), Bool2D(Size(), Bool1D(NBins(), false)));
+        return BufferPool::TakeMask(Size(), NBins());
     }
 
-    void PhotonCount::AddPhoton(double time, TVector3 position, int thinning)
+    PhotonCount::AddResult PhotonCount::AddPhoton(double time, TVector3 position, int thinning)
     {
         if (position == TVector3())
             throw invalid_argument("Direction cannot be a zero vector");
-        if (time < min_time || time > max_time) return;
+        if (time < min_time || time > max_time) return AddResult::out_of_time;
 
         TVector3 direction = -position;
         double elevate = ATan2(direction.Y(), direction.Z());
@@ -212,13 +289,12 @@ namespace cherenkov_simulator
         auto y_index = (int) (Floor(elevate / ang_size) + n_pixels / 2);
         auto x_index = (int) (Floor(azimuth / ang_size / Cos(elevate)) + n_pixels / 2);
         
-        if (IsValid(x_index, y_index))
-        {
-            IncrementCell(thinning, (size_t) x_index, (size_t) y_index, Bin(time));
-            if (time > last_time) last_time = time;
-            if (time < frst_time) frst_time = time;
-            trimd = false;
-        }
+        if (!IsValid(x_index, y_index)) return AddResult::out_of_range;
+        IncrementCell(thinning, (size_t) x_index, (size_t) y_index, Bin(time));
+        if (time > last_time) last_time = time;
+        if (time < frst_time) frst_time = time;
+        trimd = false;
+        return AddResult::added;
     }
 
     void PhotonCount::AddNoise(double noise_rate, const Iterator& iter)
@@ -226,7 +302,62 @@ namespace cherenkov_simulator
         Trim();
         double mean = RealNoiseRate(noise_rate);
         for (size_t i = 0; i < NBins(); i++)
-            IncrementCell(gRandom->Poisson(mean), iter, i);
+            IncrementCell(Utility::Rng().Poisson(mean), iter, i);
+    }
+
+    void PhotonCount::AddSparseNoise(double noise_rate, const Iterator& iter)
+    {
+        Trim();
+        double mean = RealNoiseRate(noise_rate);
+        if (mean <= 0) return;
+        if (mean > 1.0)
+        {
+            AddNoise(noise_rate, iter);
+            return;
+        }
+
+        // The number of empty bins before the next nonzero one is floor(E / mean), with E exponential.
+        auto n_bins = (double) NBins();
+        double bin = Floor(-Log(Utility::Rng().Rndm()) / mean);
+        while (bin < n_bins)
+        {
+            IncrementCell(PoissonTail(mean, 1), iter, (size_t) bin);
+            bin += 1.0 + Floor(-Log(Utility::Rng().Rndm()) / mean);
+        }
+    }
+
+    void PhotonCount::AddTailNoise(double noise_rate, int threshold, const Iterator& iter)
+    {
+        Trim();
+        double mean = RealNoiseRate(noise_rate);
+        auto offset = (int) mean;
+
+        // Find the bins with signal before any noise is added, since noise can bring them back to zero.
+        vector<size_t> signal_bins = vector<size_t>();
+        if (sums[iter.X()][iter.Y()] != 0)
+        {
+            for (size_t i = 0; i < NBins(); i++)
+                if (counts[iter.X()][iter.Y()][i] != 0) signal_bins.push_back(i);
+        }
+        for (size_t i : signal_bins)
+            IncrementCell(Utility::Rng().Poisson(mean) - offset, iter, i);
+
+        // Each of the other bins crosses the threshold independently, so the gaps between them are geometric.
+        int min_count = std::max(threshold + offset + 1, 0);
+        double tail_prob = PoissonSum(mean, min_count);
+        if (tail_prob <= 0) return;
+        double log_miss = tail_prob < 1.0 ? log1p(-tail_prob) : -Infinity();
+        auto n_bins = (double) NBins();
+        auto next_signal = signal_bins.begin();
+        double bin = Floor(Log(Utility::Rng().Rndm()) / log_miss);
+        while (bin < n_bins)
+        {
+            auto i = (size_t) bin;
+            while (next_signal != signal_bins.end() && *next_signal < i) next_signal++;
+            if (next_signal == signal_bins.end() || *next_signal != i)
+                IncrementCell(PoissonTail(mean, min_count) - offset, iter, i);
+            bin += 1.0 + Floor(Log(Utility::Rng().Rndm()) / log_miss);
+        }
     }
 
     void PhotonCount::Subtract(double noise_rate, const Iterator& iter)
@@ -239,15 +370,25 @@ namespace cherenkov_simulator
     Bool1D PhotonCount::AboveThreshold(const Iterator& iter, int threshold) const
     {
         Bool1D above = Bool1D(NBins());
+        AboveThreshold(iter, threshold, above);
+        return above;
+    }
+
+    void PhotonCount::AboveThreshold(const Iterator& iter, int threshold, Bool1D& above) const
+    {
+        above.resize(NBins());
         for (size_t i = 0; i < NBins(); i++)
             above[i] = counts[iter.X()][iter.Y()][i] > threshold;
-        return above;
     }
 
     int PhotonCount::FindThreshold(double noise_rate, double sigma) const
+    {
+        return PoissonThreshold(RealNoiseRate(noise_rate), sigma);
+    }
+
+    int PhotonCount::PoissonThreshold(double mean, double sigma)
     {
         double max_prob = Erfc(sigma / Sqrt(2)) / 2.0;
-        double mean = RealNoiseRate(noise_rate);
         auto thresh = (int) Floor(sigma * Sqrt(mean));
         while (PoissonSum(mean, thresh) > max_prob)
             thresh++;
@@ -334,4 +475,19 @@ namespace cherenkov_simulator
     {
         return Exp(-mean) * Power(mean, x) / Factorial(x);
     }
+
+    int PhotonCount::PoissonTail(double mean, int min)
+    {
+        double target = Utility::Rng().Rndm() * PoissonSum(mean, min);
+        int k = min;
+        double prob = Poisson(mean, min);
+        double cumulative = prob;
+        while (cumulative < target && prob > 0)
+        {
+            k++;
+            prob *= mean / k;
+            cumulative += prob;
+        }
+        return k;
+    }
 }
@@ -69,6 +69,16 @@ namespace cherenkov_simulator
             int curr_y;
         };
 
+        /*
+         * The result of an attempt to add a photon.
+         */
+        enum class AddResult
+        {
+            added,
+            out_of_range,
+            out_of_time
+        };
+
         /*
          * A container for PhotonCount constructor parameters.
          */
@@ -93,6 +103,19 @@ namespace cherenkov_simulator
          */
         PhotonCount(Params params, double min_time, double max_time);
 
+        /*
+         * Copies and destruction go through the BufferPool of the calling thread, so the count cube of a finished
+         * PhotonCount is reused by the next one rather than freed. A copy is written into the existing cube if it has
+         * the same number of pixels. Moves transfer the cube without copying it, and a move assignment swaps cubes so
+         * that the old one is given back when the source is destroyed. A PhotonCount destroyed after the pools of its
+         * thread, such as one with static storage, frees its cube instead (see BufferPool).
+         */
+        PhotonCount(const PhotonCount& other);
+        PhotonCount(PhotonCount&& other) = default;
+        PhotonCount& operator=(const PhotonCount& other);
+        PhotonCount& operator=(PhotonCount&& other);
+        ~PhotonCount();
+
         /*
          * Returns a 2D vector of booleans with true values for valid pixels.
          */
@@ -109,6 +132,16 @@ namespace cherenkov_simulator
          */
         size_t NBins() const;
 
+        /*
+         * Returns the width of each time bin.
+         */
+        double BinSize() const;
+
+        /*
+         * Returns the angular size of each pixel.
+         */
+        double AngSize() const;
+
         /*
          * Returns true if no photons have been added. Emptiness will not change in the AddNoise method if all the
          * random noise values are zero.
@@ -173,17 +206,20 @@ namespace cherenkov_simulator
         Iterator GetIterator() const;
 
         /*
-         * Returns a 3D vector of false values with the same dimensions as the PhotonCount underlying 3D vector.
+         * Returns a 3D vector of false values with the same dimensions as the PhotonCount underlying 3D vector. The
+         * matrix is taken from the BufferPool, and can be given back with BufferPool::GiveMask() once it is no longer
+         * needed.
          */
         Bool3D GetFalseMatrix() const;
 
         /*
          * Increments a bin of the photon count histogram of the pixel at the specified position. Nothing is done
-         * if the time is outside [min_time, max_time] or the position is outside the disk-shaped pixel array. An
-         * invalid_argument exception is thrown if the position vector is zero. Note that the position specified for
-         * this method is not the same as the return from Direction(). direction = -position.Unit().
+         * if the time is outside [min_time, max_time] or the position is outside the disk-shaped pixel array, and the
+         * return value says which. An invalid_argument exception is thrown if the position vector is zero. Note that
+         * the position specified for this method is not the same as the return from Direction().
+         * direction = -position.Unit().
          */
-        void AddPhoton(double time, TVector3 position, int thinning);
+        AddResult AddPhoton(double time, TVector3 position, int thinning);
 
         /*
          * Adds background noise to the time series at the specified position. A random Poisson value is generated for
@@ -192,6 +228,25 @@ namespace cherenkov_simulator
          */
         void AddNoise(double noise_rate, const Iterator& iter);
 
+        /*
+         * Same as above, but only visits the bins which receive noise. Each bin is nonzero with probability
+         * 1 - exp(-mean), so the gaps between nonzero bins are drawn from a geometric distribution and the count in
+         * each nonzero bin from a Poisson distribution conditioned on being positive. The result has the same
+         * distribution as AddNoise(), with a cost proportional to the number of noise photons rather than the number
+         * of bins. Falls back to AddNoise() if the mean is large enough that most bins receive noise.
+         */
+        void AddSparseNoise(double noise_rate, const Iterator& iter);
+
+        /*
+         * Adds noise as it would look after Subtract(), but only where it could survive a later threshold. Bins with
+         * signal get a Poisson draw less the integer part of the mean, as AddNoise() and Subtract() would give. In the
+         * other bins, only values above the threshold are kept, so these bins are chosen by drawing geometric gaps
+         * with the probability of crossing the threshold, and their counts are drawn from the tail of the Poisson
+         * distribution. All other bins are left at zero. Values at or below the threshold differ from AddNoise(), so
+         * this is only equivalent for uses which discard them.
+         */
+        void AddTailNoise(double noise_rate, int threshold, const Iterator& iter);
+
         /*
          * Subtract the average noise rate from the signal in the pixel specified by the iterator. Like AddNoise(), the
          * input rate is the number per second per steradian, which is converted to the appropriate units.
@@ -205,6 +260,11 @@ namespace cherenkov_simulator
          */
         Bool1D AboveThreshold(const Iterator& iter, int threshold) const;
 
+        /*
+         * Same as above, but writes into an existing vector, reusing its memory.
+         */
+        void AboveThreshold(const Iterator& iter, int threshold, Bool1D& above) const;
+
         /*
          * Determines the appropriate threshold given the noise rate (in number per second per sr per square cm) and the
          * number of standard deviations above the mean where the threshold should be set. This is done by upping the
@@ -213,6 +273,12 @@ namespace cherenkov_simulator
          */
         int FindThreshold(double noise_rate, double sigma) const;
 
+        /*
+         * Same as above, but takes the average number of noise photons in a single bin of a pixel. This allows the
+         * threshold to be found before any PhotonCount has been constructed.
+         */
+        static int PoissonThreshold(double mean, double sigma);
+
         /*
          * Zeroes any photon counts which do not correspond to a true value in the 3D input vector.
          */
@@ -226,6 +292,11 @@ namespace cherenkov_simulator
     private:
 
         friend class DataStructuresTest;
+        friend class EventWriter;
+        friend class EventReader;
+        friend class IndexedEventWriter;
+        friend class PhotonCountView;
+        friend class PhotonCodec;
 
         Short3D counts;
         Short2D sums;
@@ -282,6 +353,12 @@ namespace cherenkov_simulator
          * Calculates a particular value of a Poisson distribution with specified mean.
          */
         static double Poisson(double mean, int x);
+
+        /*
+         * Draws from a Poisson distribution with specified mean, conditioned on the value being at least min, by
+         * inverting its distribution function.
+         */
+        static int PoissonTail(double mean, int min);
     };
 }
 
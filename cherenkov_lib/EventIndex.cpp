@@ -0,0 +1,313 @@
+// EventIndex.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of EventIndex.h
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "EventIndex.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    // Identifies indexed event files and their format version.
+    const char index_magic[8] = {'C', 'H', 'K', 'V', 'I', 'D', 'X', '2'};
+
+    // The header at the start of an indexed event file.
+    struct IndexHeader
+    {
+        char magic[8];
+        uint64_t n_events;
+        uint64_t index_offset;
+    };
+
+    // An entry of the table of identifiers which follows the offsets, sorted by identifier.
+    struct IdentEntry
+    {
+        char ident[32];
+        uint64_t event;
+    };
+
+    // Block flags
+    const uint32_t flag_empty = 1;
+    const uint32_t flag_trimd = 2;
+
+    /*
+     * Rounds the size up to the next multiple of eight bytes.
+     */
+    static size_t Padded(size_t size)
+    {
+        return (size + 7) / 8 * 8;
+    }
+
+    IndexedEventWriter::IndexedEventWriter(string filename) : filename(filename)
+    {
+        out.open(filename, ios::binary | ios::trunc);
+        if (out.fail())
+            throw runtime_error("The file " + filename + " could not be opened. Check the path.");
+        IndexHeader header = IndexHeader();
+        out.write((const char*) &header, sizeof(header));
+    }
+
+    IndexedEventWriter::~IndexedEventWriter()
+    {
+        try
+        {
+            if (out.is_open()) Close();
+        }
+        catch (exception& err)
+        {
+            cout << err.what() << endl;
+        }
+    }
+
+    void IndexedEventWriter::Write(string ident, const Shower& shower, const PhotonCount& data)
+    {
+        offsets.push_back((uint64_t) out.tellp());
+
+        EventBlock block = EventBlock();
+        strncpy(block.ident, ident.c_str(), sizeof(block.ident) - 1);
+        idents.push_back(string(block.ident));
+        TVector3 position = shower.Position();
+        TVector3 direction = shower.Direction();
+        double shower_values[9] = {shower.EnergyeV(), shower.Elevation(), position.X(), position.Y(), position.Z(),
+                                   direction.X(), direction.Y(), direction.Z(), shower.Time()};
+        copy(shower_values, shower_values + 9, block.shower);
+        double timing_values[7] = {data.bin_size, data.ang_size, data.lin_size, data.min_time, data.max_time,
+                                   data.frst_time, data.last_time};
+        copy(timing_values, timing_values + 7, block.timing);
+
+        vector<uint32_t> pixels = vector<uint32_t>();
+        for (size_t i = 0; i < data.Size(); i++)
+            for (size_t j = 0; j < data.Size(); j++)
+                if (data.sums[i][j] != 0) pixels.push_back((uint32_t) (i * data.Size() + j));
+        block.n_pixels = (uint32_t) data.n_pixels;
+        block.n_bins = data.counts.empty() ? 0 : (uint32_t) data.counts[0][0].size();
+        block.n_filled = (uint32_t) pixels.size();
+        block.flags = (data.empty ? flag_empty : 0) | (data.trimd ? flag_trimd : 0);
+        out.write((const char*) &block, sizeof(block));
+
+        // Pad after each array so the counts and the next block are aligned.
+        const char padding[8] = {};
+        size_t pixel_bytes = pixels.size() * sizeof(uint32_t);
+        out.write((const char*) pixels.data(), pixel_bytes);
+        out.write(padding, Padded(pixel_bytes) - pixel_bytes);
+        for (uint32_t pixel : pixels)
+            out.write((const char*) data.counts[pixel / data.Size()][pixel % data.Size()].data(),
+                      block.n_bins * sizeof(short));
+        size_t count_bytes = pixels.size() * block.n_bins * sizeof(short);
+        out.write(padding, Padded(count_bytes) - count_bytes);
+    }
+
+    void IndexedEventWriter::Close()
+    {
+        IndexHeader header = IndexHeader();
+        copy(index_magic, index_magic + sizeof(index_magic), header.magic);
+        header.n_events = offsets.size();
+        header.index_offset = (uint64_t) out.tellp();
+        out.write((const char*) offsets.data(), offsets.size() * sizeof(uint64_t));
+
+        // Events with the same identifier stay in the order they were written, so Find() returns the first.
+        vector<IdentEntry> table = vector<IdentEntry>(offsets.size());
+        for (size_t n = 0; n < table.size(); n++)
+        {
+            strncpy(table[n].ident, idents[n].c_str(), sizeof(table[n].ident) - 1);
+            table[n].event = n;
+        }
+        stable_sort(table.begin(), table.end(), [](const IdentEntry& a, const IdentEntry& b) {
+            return strncmp(a.ident, b.ident, sizeof(a.ident)) < 0;
+        });
+        out.write((const char*) table.data(), table.size() * sizeof(IdentEntry));
+        out.seekp(0);
+        out.write((const char*) &header, sizeof(header));
+        out.close();
+        if (out.fail()) throw runtime_error("The indexed event file " + filename + " could not be written.");
+    }
+
+    PhotonCountView::PhotonCountView(const char* block)
+    {
+        header = (const EventBlock*) block;
+        pixels = (const uint32_t*) (block + sizeof(EventBlock));
+        counts = (const short*) (block + sizeof(EventBlock) + Padded(header->n_filled * sizeof(uint32_t)));
+    }
+
+    string PhotonCountView::Ident() const
+    {
+        return string(header->ident, strnlen(header->ident, sizeof(header->ident)));
+    }
+
+    Shower PhotonCountView::GetShower() const
+    {
+        const double* values = header->shower;
+        TVector3 position = TVector3(values[2], values[3], values[4]);
+        TVector3 direction = TVector3(values[5], values[6], values[7]);
+        return Shower(values[0], values[1], position, direction, values[8]);
+    }
+
+    size_t PhotonCountView::Size() const
+    {
+        return header->n_pixels;
+    }
+
+    size_t PhotonCountView::NBins() const
+    {
+        return header->n_bins;
+    }
+
+    size_t PhotonCountView::NFilled() const
+    {
+        return header->n_filled;
+    }
+
+    const short* PhotonCountView::Signal(size_t x_index, size_t y_index) const
+    {
+        auto pixel = (uint32_t) (x_index * Size() + y_index);
+        const uint32_t* end = pixels + NFilled();
+        const uint32_t* found = lower_bound(pixels, end, pixel);
+        if (found == end || *found != pixel) return nullptr;
+        return counts + (found - pixels) * NBins();
+    }
+
+    int PhotonCountView::SumBins(size_t x_index, size_t y_index) const
+    {
+        const short* signal = Signal(x_index, y_index);
+        if (signal == nullptr) return 0;
+        int sum = 0;
+        for (size_t t = 0; t < NBins(); t++)
+            sum += signal[t];
+        return sum;
+    }
+
+    PhotonCount PhotonCountView::ToPhotonCount() const
+    {
+        const double* timing = header->timing;
+        PhotonCount::Params params = PhotonCount::Params();
+        params.n_pixels = header->n_pixels;
+        params.max_byte = numeric_limits<size_t>::max();
+        params.bin_size = timing[0];
+        params.ang_size = timing[1];
+        params.lin_size = timing[2];
+        PhotonCount data = PhotonCount(params, timing[3], timing[4]);
+        data.frst_time = timing[5];
+        data.last_time = timing[6];
+        data.empty = (header->flags & flag_empty) != 0;
+        data.trimd = (header->flags & flag_trimd) != 0;
+
+        // Trimming can leave the vectors one bin different from what NBins() computes, so match the stored length.
+        if (NBins() != data.NBins())
+            for (auto& column : data.counts)
+                for (auto& signal : column)
+                    signal.resize(NBins(), 0);
+        for (size_t k = 0; k < NFilled(); k++)
+        {
+            size_t i = pixels[k] / Size();
+            size_t j = pixels[k] % Size();
+            const short* signal = counts + k * NBins();
+            data.counts[i][j].assign(signal, signal + NBins());
+            data.sums[i][j] = (short) SumBins(i, j);
+        }
+        return data;
+    }
+
+    IndexedEventFile::IndexedEventFile(string filename)
+    {
+        int descriptor = open(filename.c_str(), O_RDONLY);
+        if (descriptor < 0)
+            throw runtime_error("The file " + filename + " could not be opened. Check the path.");
+        struct stat file_stat;
+        if (fstat(descriptor, &file_stat) != 0)
+        {
+            close(descriptor);
+            throw runtime_error("The size of the file " + filename + " could not be read.");
+        }
+        length = (size_t) file_stat.st_size;
+        void* address = MAP_FAILED;
+        if (length >= sizeof(IndexHeader))
+            address = mmap(nullptr, length, PROT_READ, MAP_SHARED, descriptor, 0);
+        close(descriptor);
+        if (address == MAP_FAILED)
+            throw runtime_error("The file " + filename + " could not be mapped into memory.");
+        mapped = (const char*) address;
+
+        // Dividing what is left of the file, rather than multiplying the number of events, can't overflow.
+        const auto* header = (const IndexHeader*) mapped;
+        bool valid = equal(index_magic, index_magic + sizeof(index_magic), header->magic);
+        valid = valid && header->index_offset <= length && header->index_offset % 8 == 0;
+        valid = valid && header->n_events <= (length - header->index_offset) / (sizeof(uint64_t) + sizeof(IdentEntry));
+        if (!valid)
+        {
+            munmap((void*) mapped, length);
+            throw runtime_error("The file " + filename + " is not a closed indexed event file.");
+        }
+        n_events = header->n_events;
+        index = (const uint64_t*) (mapped + header->index_offset);
+        table = (const IdentEntry*) (index + n_events);
+    }
+
+    IndexedEventFile::~IndexedEventFile()
+    {
+        munmap((void*) mapped, length);
+    }
+
+    size_t IndexedEventFile::NEvents() const
+    {
+        return n_events;
+    }
+
+    PhotonCountView IndexedEventFile::Event(size_t n) const
+    {
+        if (n >= n_events)
+            throw out_of_range("Invalid event number");
+        return PhotonCountView(Block(n));
+    }
+
+    size_t IndexedEventFile::Find(string ident) const
+    {
+        // Identifiers are truncated when written, so longer ones can't match.
+        IdentEntry key = IdentEntry();
+        if (ident.size() < sizeof(key.ident))
+        {
+            strncpy(key.ident, ident.c_str(), sizeof(key.ident) - 1);
+            const IdentEntry* end = table + n_events;
+            const IdentEntry* found = lower_bound(table, end, key, [](const IdentEntry& a, const IdentEntry& b) {
+                return strncmp(a.ident, b.ident, sizeof(a.ident)) < 0;
+            });
+            if (found != end && strncmp(found->ident, key.ident, sizeof(key.ident)) == 0)
+            {
+                if (found->event >= n_events)
+                    throw runtime_error("The identifier table of the indexed event file is corrupt.");
+                return (size_t) found->event;
+            }
+        }
+        throw out_of_range("No event with identifier " + ident);
+    }
+
+    const char* IndexedEventFile::Block(size_t n) const
+    {
+        // Each step compares against what is left of the file, so corrupt sizes can't overflow the sums.
+        uint64_t offset = index[n];
+        bool valid = offset % 8 == 0 && offset <= length && length - offset >= sizeof(EventBlock);
+        if (valid)
+        {
+            const auto* block = (const EventBlock*) (mapped + offset);
+            uint64_t remaining = length - offset - sizeof(EventBlock);
+            uint64_t pixel_bytes = Padded((uint64_t) block->n_filled * sizeof(uint32_t));
+            valid = pixel_bytes <= remaining;
+            remaining = valid ? remaining - pixel_bytes : 0;
+            uint64_t signal_bytes = (uint64_t) block->n_bins * sizeof(short);
+            valid = valid && (signal_bytes == 0 || block->n_filled <= remaining / signal_bytes);
+            valid = valid && Padded(block->n_filled * signal_bytes) <= remaining;
+        }
+        if (!valid) throw runtime_error("Event " + to_string(n) + " extends past the end of the indexed event file.");
+        return mapped + offset;
+    }
+}
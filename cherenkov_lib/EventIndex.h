@@ -0,0 +1,192 @@
+// EventIndex.h
+//
+// Author: Matthew Dutson
+//
+// Defines IndexedEventWriter, IndexedEventFile, and PhotonCountView classes
+
+#ifndef EVENT_INDEX_H
+#define EVENT_INDEX_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "DataStructures.h"
+#include "Geometric.h"
+
+namespace cherenkov_simulator
+{
+    struct IdentEntry;
+
+    /*
+     * The fixed-layout header at the start of every event block in an indexed event file. It is followed by n_filled
+     * pixel indices (x * n_pixels + y, in increasing order) and then by n_filled signals of n_bins shorts each. Blocks
+     * are padded to a multiple of eight bytes so that every block can be read in place from a memory-mapped file.
+     */
+    struct EventBlock
+    {
+        char ident[32];
+        double shower[9];
+        double timing[7];
+        uint32_t n_pixels;
+        uint32_t n_bins;
+        uint32_t n_filled;
+        uint32_t flags;
+    };
+
+    /*
+     * Writes events to an indexed event file. The file consists of a header, the event blocks, an index with the
+     * offset of every block, and a table of identifiers sorted for binary search. The index, table, and header are
+     * written by Close(), so a file is only readable once it has been closed.
+     */
+    class IndexedEventWriter
+    {
+    public:
+
+        /*
+         * Opens the file and reserves space for the header. Throws a runtime_error if the file can't be opened.
+         */
+        explicit IndexedEventWriter(std::string filename);
+
+        /*
+         * Closes the file if Close() hasn't already been called.
+         */
+        ~IndexedEventWriter();
+
+        /*
+         * Writes a single event block. Identifiers longer than 31 characters are truncated.
+         */
+        void Write(std::string ident, const Shower& shower, const PhotonCount& data);
+
+        /*
+         * Writes the index and the header and closes the file. Throws a runtime_error if any of the file couldn't be
+         * written.
+         */
+        void Close();
+
+    private:
+
+        std::string filename;
+        std::ofstream out;
+        std::vector<uint64_t> offsets;
+        std::vector<std::string> idents;
+    };
+
+    /*
+     * A read-only view of one event block in a memory-mapped indexed event file. Signals are read in place, without
+     * copying. The view is only valid as long as the IndexedEventFile which created it is open.
+     */
+    class PhotonCountView
+    {
+    public:
+
+        /*
+         * Constructs a view of the event block at the specified address.
+         */
+        explicit PhotonCountView(const char* block);
+
+        /*
+         * Returns the identifier which was passed to IndexedEventWriter::Write().
+         */
+        std::string Ident() const;
+
+        /*
+         * Reconstructs the true Shower of the event.
+         */
+        Shower GetShower() const;
+
+        /*
+         * Returns the diameter of the pixel array in number of pixels.
+         */
+        size_t Size() const;
+
+        /*
+         * Returns the number of bins in each of the time series.
+         */
+        size_t NBins() const;
+
+        /*
+         * Returns the number of pixels which saw at least one photon.
+         */
+        size_t NFilled() const;
+
+        /*
+         * Returns a pointer to the NBins() counts of the specified pixel, or nullptr if the pixel saw no photons. The
+         * pixels with signal are found by binary search.
+         */
+        const short* Signal(size_t x_index, size_t y_index) const;
+
+        /*
+         * Sums the time series of the specified pixel.
+         */
+        int SumBins(size_t x_index, size_t y_index) const;
+
+        /*
+         * Copies the event into a full PhotonCount, which can then be passed to the Reconstructor.
+         */
+        PhotonCount ToPhotonCount() const;
+
+    private:
+
+        const EventBlock* header;
+        const uint32_t* pixels;
+        const short* counts;
+    };
+
+    /*
+     * Opens an indexed event file by mapping it into memory. Any event can be accessed in constant time, regardless of
+     * its position in the file.
+     */
+    class IndexedEventFile
+    {
+    public:
+
+        /*
+         * Maps the file and checks its header. Throws a runtime_error if the file can't be opened or isn't a closed
+         * indexed event file.
+         */
+        explicit IndexedEventFile(std::string filename);
+
+        /*
+         * Unmaps the file.
+         */
+        ~IndexedEventFile();
+
+        IndexedEventFile(const IndexedEventFile&) = delete;
+        IndexedEventFile& operator=(const IndexedEventFile&) = delete;
+
+        /*
+         * Returns the number of events in the file.
+         */
+        size_t NEvents() const;
+
+        /*
+         * Returns a view of the nth event. Throws an out_of_range exception if n >= NEvents(), and a runtime_error if
+         * the block extends past the end of the file.
+         */
+        PhotonCountView Event(size_t n) const;
+
+        /*
+         * Returns the position of the first event written with the specified identifier, found by binary search of
+         * the identifier table without touching the event blocks. Throws an out_of_range exception if there is no such
+         * event, and a runtime_error if the table is corrupt.
+         */
+        size_t Find(std::string ident) const;
+
+    private:
+
+        const char* mapped;
+        size_t length;
+        uint64_t n_events;
+        const uint64_t* index;
+        const IdentEntry* table;
+
+        /*
+         * Returns the address of the nth block, after checking that the block and its arrays lie within the file.
+         */
+        const char* Block(size_t n) const;
+    };
+}
+
+#endif
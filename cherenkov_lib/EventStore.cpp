@@ -0,0 +1,136 @@
+// EventStore.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of EventStore.h
+
+#include <cstdint>
+#include <limits>
+
+#include "EventStore.h"
+#include "PhotonCodec.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    // Identifies event files and their format version.
+    const char event_magic[8] = {'C', 'H', 'K', 'V', 'E', 'V', 'T', '2'};
+
+    EventWriter::EventWriter(string filename, bool append, bool delta)
+    {
+        this->delta = delta;
+        out.open(filename, ios::binary | (append ? ios::app : ios::trunc));
+        if (out.fail())
+            throw runtime_error("The file " + filename + " could not be opened. Check the path.");
+        if (!append) out.write(event_magic, sizeof(event_magic));
+    }
+
+    void EventWriter::Write(string ident, const Shower& shower, const PhotonCount& data)
+    {
+        Put<uint32_t>((uint32_t) ident.size());
+        out.write(ident.data(), ident.size());
+
+        Put<double>(shower.EnergyeV());
+        Put<double>(shower.Elevation());
+        for (int i = 0; i < 3; i++) Put<double>(shower.Position()[i]);
+        for (int i = 0; i < 3; i++) Put<double>(shower.Direction()[i]);
+        Put<double>(shower.Time());
+
+        Put<uint32_t>((uint32_t) data.n_pixels);
+        Put<double>(data.bin_size);
+        Put<double>(data.ang_size);
+        Put<double>(data.lin_size);
+        Put<double>(data.min_time);
+        Put<double>(data.max_time);
+        Put<double>(data.frst_time);
+        Put<double>(data.last_time);
+        Put<uint8_t>((uint8_t) data.empty);
+        Put<uint8_t>((uint8_t) data.trimd);
+
+        // The signal is stored zero-suppressed, preceded by its length so a reader can pull it in with one read.
+        payload.clear();
+        PhotonCodec::Encode(data, delta, payload);
+        Put<uint64_t>((uint64_t) payload.size());
+        out.write(payload.data(), payload.size());
+    }
+
+    long EventWriter::Flush()
+    {
+        out.flush();
+        return (long) out.tellp();
+    }
+
+    template<typename T>
+    void EventWriter::Put(T value)
+    {
+        out.write((const char*) &value, sizeof(T));
+    }
+
+    EventReader::EventReader(string filename)
+    {
+        in.open(filename, ios::binary);
+        if (in.fail())
+            throw runtime_error("The file " + filename + " could not be opened. Check the path.");
+        char magic[sizeof(event_magic)];
+        in.read(magic, sizeof(magic));
+        if (in.gcount() != sizeof(magic) || !equal(magic, magic + sizeof(magic), event_magic))
+            throw runtime_error("The file " + filename + " is not an event file.");
+    }
+
+    bool EventReader::Next(string& ident, Shower& shower, PhotonCount& data)
+    {
+        if (in.peek() == char_traits<char>::eof()) return false;
+
+        auto ident_size = Get<uint32_t>();
+        ident = string(ident_size, ' ');
+        in.read(&ident[0], ident_size);
+
+        auto energy = Get<double>();
+        auto elevation = Get<double>();
+        TVector3 position, direction;
+        for (int i = 0; i < 3; i++) position[i] = Get<double>();
+        for (int i = 0; i < 3; i++) direction[i] = Get<double>();
+        auto time = Get<double>();
+        shower = Shower(energy, elevation, position, direction, time);
+
+        PhotonCount::Params params = PhotonCount::Params();
+        params.n_pixels = Get<uint32_t>();
+        params.max_byte = numeric_limits<size_t>::max();
+        params.bin_size = Get<double>();
+        params.ang_size = Get<double>();
+        params.lin_size = Get<double>();
+        auto min_time = Get<double>();
+        auto max_time = Get<double>();
+        data = PhotonCount(params, min_time, max_time);
+        data.frst_time = Get<double>();
+        data.last_time = Get<double>();
+        data.empty = Get<uint8_t>() != 0;
+        data.trimd = Get<uint8_t>() != 0;
+
+        auto payload_size = Get<uint64_t>();
+        payload.resize(payload_size);
+        in.read(&payload[0], payload_size);
+        if (in.fail())
+            throw runtime_error("The event file ended partway through an event.");
+
+        // Trimming can leave the vectors one bin different from what NBins() computes, so match the stored length.
+        SignalDecoder decoder = SignalDecoder(payload.data(), payload.data() + payload.size());
+        if (decoder.NBins() != data.NBins())
+            for (auto& column : data.counts)
+                for (auto& signal : column)
+                    signal.resize(decoder.NBins(), 0);
+        PhotonCodec::Decode(payload, data);
+        return true;
+    }
+
+    template<typename T>
+    T EventReader::Get()
+    {
+        T value;
+        in.read((char*) &value, sizeof(T));
+        if (in.fail())
+            throw runtime_error("The event file ended partway through an event.");
+        return value;
+    }
+}
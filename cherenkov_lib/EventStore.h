@@ -0,0 +1,90 @@
+// EventStore.h
+//
+// Author: Matthew Dutson
+//
+// Defines EventWriter and EventReader classes
+
+#ifndef EVENT_STORE_H
+#define EVENT_STORE_H
+
+#include <fstream>
+#include <string>
+
+#include "DataStructures.h"
+#include "Geometric.h"
+
+namespace cherenkov_simulator
+{
+    /*
+     * Writes simulated events to a compact binary file. Each event consists of an identifier, the true Shower, and the
+     * noiseless PhotonCount produced by the Simulator. The signal is stored with the zero-suppressed PhotonCodec
+     * encoding. The file is written in the native byte order, so it should be read on a machine with the same
+     * architecture.
+     */
+    class EventWriter
+    {
+    public:
+
+        /*
+         * Opens the file and writes the file header. Throws a runtime_error if the file can't be opened. If append is
+         * true, events are added to the end of an existing file and no header is written. If delta is true, signals
+         * are delta coded in time.
+         */
+        explicit EventWriter(std::string filename, bool append = false, bool delta = false);
+
+        /*
+         * Writes a single event to the file.
+         */
+        void Write(std::string ident, const Shower& shower, const PhotonCount& data);
+
+        /*
+         * Flushes buffered events to disk and returns the current size of the file in bytes.
+         */
+        long Flush();
+
+    private:
+
+        std::ofstream out;
+        std::string payload;
+        bool delta;
+
+        /*
+         * Writes the raw bytes of a plain value to the file.
+         */
+        template<typename T>
+        void Put(T value);
+    };
+
+    /*
+     * Reads events written by an EventWriter, one at a time and in the order they were written.
+     */
+    class EventReader
+    {
+    public:
+
+        /*
+         * Opens the file and checks the file header. Throws a runtime_error if the file can't be opened or isn't an
+         * event file.
+         */
+        explicit EventReader(std::string filename);
+
+        /*
+         * Reads the next event from the file. Returns false if there are no events left. Throws a runtime_error if the
+         * file ends partway through an event.
+         */
+        bool Next(std::string& ident, Shower& shower, PhotonCount& data);
+
+    private:
+
+        std::ifstream in;
+        std::string payload;
+
+        /*
+         * Reads the raw bytes of a plain value from the file. Throws a runtime_error if the file ends too early.
+         */
+        template<typename T>
+        T Get();
+    };
+}
+
+#endif
@@ -172,6 +172,11 @@ namespace cherenkov_simulator
         return energy;
     }
 
+    double Shower::Elevation() const
+    {
+        return elevation;
+    }
+
     double Shower::ImpactParam() const
     {
         return Position().Cross(Position() + Direction()).Mag();
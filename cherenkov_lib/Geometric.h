@@ -204,6 +204,11 @@ namespace cherenkov_simulator
          */
         double EnergyeV() const;
 
+        /*
+         * Returns the elevation of the detector above sea level, which was passed to the constructor.
+         */
+        double Elevation() const;
+
         /*
          * Calculates the impact parameter of the shower, assuming the detector is at the origin. See
          * http://mathworld.wolfram.com/Point-LineDistance3-Dimensional.html for an explanation of the point-line
@@ -4,9 +4,20 @@
 //
 // Implementation of MonteCarlo.h
 
-#include <fstream>
-#include <TFile.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <future>
+#include <limits>
+#include <memory>
+#include <unistd.h>
+#include <boost/property_tree/xml_parser.hpp>
+#include <Math/MinimizerOptions.h>
+#include <TDirectory.h>
 #include <TMath.h>
+#include <TROOT.h>
 
 #include "MonteCarlo.h"
 #include "Analysis.h"
@@ -17,45 +28,303 @@ using namespace TMath;
 
 namespace cherenkov_simulator
 {
-    MonteCarlo::MonteCarlo(const ptree& config) : simulator(config), reconstructor(config)
+    MonteCarlo::Checkpoint::Checkpoint()
+    {
+        next_id = 1;
+        n_untriggered = 0;
+        n_rejected = 0;
+        trig_weight = 0;
+        start_seed = 0;
+        csv_offset = 0;
+        evt_offset = 0;
+        monitor_stats = ConvergenceMonitor::EmptyStats();
+    }
+
+    void MonteCarlo::Checkpoint::Write(string filename) const
+    {
+        ptree tree = ptree();
+        tree.put("checkpoint.next_id", next_id);
+        tree.put("checkpoint.n_untriggered", n_untriggered);
+        tree.put("checkpoint.n_rejected", n_rejected);
+        tree.put("checkpoint.trig_weight", trig_weight);
+        tree.put("checkpoint.start_seed", start_seed);
+        tree.put("checkpoint.csv_offset", csv_offset);
+        tree.put("checkpoint.evt_offset", evt_offset);
+        for (size_t i = 0; i < stratum_stats.size(); i++)
+        {
+            ptree& stratum = tree.add("checkpoint.stratum", "");
+            stratum.put("attempts", stratum_attempts[i]);
+            stratum.put("stats", stratum_stats[i].ToString());
+        }
+        for (const RunningStat& stat : monitor_stats)
+            tree.add("checkpoint.monitor", stat.ToString());
+
+        string temp_file = filename + ".tmp";
+        write_xml(temp_file, tree);
+        if (rename(temp_file.c_str(), filename.c_str()) != 0)
+            throw runtime_error("The checkpoint " + filename + " could not be written.");
+    }
+
+    MonteCarlo::Checkpoint MonteCarlo::Checkpoint::Read(string filename)
+    {
+        ptree tree = Utility::ParseXMLFile(filename).get_child("checkpoint");
+        Checkpoint ckpt = Checkpoint();
+        ckpt.next_id = tree.get<int>("next_id");
+        ckpt.n_untriggered = tree.get<int>("n_untriggered");
+        ckpt.n_rejected = tree.get<int>("n_rejected", 0);
+        ckpt.trig_weight = tree.get<double>("trig_weight", 0.0);
+        ckpt.start_seed = tree.get<unsigned int>("start_seed");
+        ckpt.csv_offset = tree.get<long>("csv_offset");
+        ckpt.evt_offset = tree.get<long>("evt_offset");
+        for (auto& child : tree)
+        {
+            if (child.first != "stratum") continue;
+            ckpt.stratum_attempts.push_back(child.second.get<int>("attempts"));
+            ckpt.stratum_stats.push_back(RunningStat::FromString(child.second.get<string>("stats")));
+        }
+
+        // Checkpoints from before the monitor was added start it from scratch.
+        vector<RunningStat> monitor_stats = vector<RunningStat>();
+        for (auto& child : tree)
+            if (child.first == "monitor") monitor_stats.push_back(RunningStat::FromString(child.second.data()));
+        if (monitor_stats.size() == ConvergenceMonitor::n_quantities) ckpt.monitor_stats = monitor_stats;
+        else if (!monitor_stats.empty()) throw runtime_error("The checkpoint " + filename + " is corrupted.");
+        return ckpt;
+    }
+
+    MonteCarlo::MonteCarlo(const ptree& config) : simulator(config), reconstructor(config), monitor(config)
     {
         elevation = config.get<double>("surroundings.elevation");
         n_showers = config.get<int>("simulation.n_showers");
+        n_threads = config.get<int>("simulation.n_threads");
+        if (n_threads < 1) throw runtime_error("The number of threads must be at least one.");
+        id_offset = config.get<int>("simulation.id_offset");
+        if (id_offset < 0) throw runtime_error("The ID offset must not be negative.");
+        pre_trigger = config.get<double>("simulation.pre_trigger");
+        n_noise = config.get<int>("simulation.n_noise");
+        if (n_noise < 1) throw runtime_error("The number of noise realizations must be at least one.");
+        trigger_signal = reconstructor.TriggerSignal(simulator.CountParams());
+        ckpt_every = config.get<int>("simulation.ckpt_every");
+        save_events = config.get<bool>("simulation.save_events");
+        delta_events = config.get<bool>("simulation.delta_events");
+        write_queue = config.get<int>("simulation.write_queue");
+        compression = config.get<int>("simulation.compression");
+        results_tree = config.get<bool>("simulation.results_tree");
+
+        string level = config.get<string>("simulation.diagnostics");
+        if (level == "none") diag_level = DiagLevel::none;
+        else if (level == "summary") diag_level = DiagLevel::summary;
+        else if (level == "full") diag_level = DiagLevel::full;
+        else throw runtime_error("The diagnostics level must be none, summary, or full.");
+        diag_every = config.get<int>("simulation.diag_every");
+        stringstream id_stream = stringstream(config.get<string>("simulation.diag_ids"));
+        string id;
+        while (getline(id_stream, id, ','))
+            if (id.find_first_not_of(" \t\n") != string::npos) diag_ids.insert(stoi(id));
 
         energy_pow = config.get<double>("monte_carlo.energy_pow");
+        energy_prop = config.get<double>("monte_carlo.energy_prop");
+        impact_prop = config.get<double>("monte_carlo.impact_prop");
+        zenith_prop = config.get<double>("monte_carlo.zenith_prop");
+        string sampling = config.get<string>("monte_carlo.sampling");
+        if (sampling == "random") halton = false;
+        else if (sampling == "halton") halton = true;
+        else throw runtime_error("The sampling must be random or halton.");
         energy_min = config.get<double>("monte_carlo.energy_min");
         energy_max = config.get<double>("monte_carlo.energy_max");
         impact_min = config.get<double>("monte_carlo.impact_min");
         impact_max = config.get<double>("monte_carlo.impact_max");
         begn_depth = config.get<double>("monte_carlo.begn_depth");
+
+        stratified = config.get<bool>("strata.stratified");
+        round_size = config.get<int>("strata.round_size");
+        if (round_size < 1) throw runtime_error("The round size must be at least one.");
+        min_showers = config.get<int>("strata.min_showers");
+        max_attempts = config.get<int>("strata.max_attempts");
+        if (!stratified)
+        {
+            strata.push_back({"all", energy_min, energy_max, impact_min, impact_max, 0, PiOver2(), 0});
+            return;
+        }
+        for (auto& child : config.get_child("strata"))
+        {
+            if (child.first != "stratum") continue;
+            const ptree& node = child.second;
+            Stratum stratum = Stratum();
+            stratum.name = node.get<string>("name", to_string(strata.size()));
+            stratum.energy_min = node.get<double>("energy_min", energy_min);
+            stratum.energy_max = node.get<double>("energy_max", energy_max);
+            stratum.impact_min = node.get<double>("impact_min", impact_min);
+            stratum.impact_max = node.get<double>("impact_max", impact_max);
+            stratum.zenith_min = node.get<double>("zenith_min", 0);
+            stratum.zenith_max = node.get<double>("zenith_max", PiOver2());
+            stratum.target = node.get<double>("target");
+            if (stratum.energy_min >= stratum.energy_max || stratum.impact_min >= stratum.impact_max ||
+                stratum.zenith_min < 0 || stratum.zenith_min >= stratum.zenith_max || stratum.zenith_max > PiOver2())
+                throw runtime_error("The ranges of stratum " + stratum.name + " are invalid.");
+            strata.push_back(stratum);
+        }
+        if (strata.empty()) throw runtime_error("A stratified run needs at least one stratum.");
     }
 
-    void MonteCarlo::PerformMonteCarlo(string output_file) const
+    void MonteCarlo::PerformMonteCarlo(string output_file, bool resume) const
     {
-        TFile file((output_file + ".root").c_str(), "RECREATE");
-        ofstream fout = ofstream(output_file + ".csv");
-        unsigned int start_seed = gRandom->GetSeed();
-        fout << "Seed,ID,Energy," << Shower::Header() << ", " << Reconstructor::Result::Header() << endl;
+        string ckpt_file = output_file + "_ckpt.xml";
+        string csv_file = output_file + ".csv";
+        string evt_file = output_file + ".evt";
+        Checkpoint ckpt = resume ? Checkpoint::Read(ckpt_file) : Checkpoint();
+        if (resume)
+        {
+            if (truncate(csv_file.c_str(), ckpt.csv_offset) != 0)
+                throw runtime_error("The file " + csv_file + " could not be truncated to the checkpoint.");
+            if (save_events && truncate(evt_file.c_str(), ckpt.evt_offset) != 0)
+                throw runtime_error("The file " + evt_file + " could not be truncated to the checkpoint.");
+        }
+        else
+        {
+            ckpt.start_seed = gRandom->GetSeed();
+            ckpt.next_id = id_offset + 1;
+            if (stratified)
+            {
+                ckpt.stratum_attempts = vector<int>(strata.size(), 0);
+                ckpt.stratum_stats = vector<RunningStat>(strata.size());
+            }
+        }
+        if (stratified && ckpt.stratum_stats.size() != strata.size())
+            throw runtime_error("The checkpoint doesn't match the strata of the configuration.");
 
-        Plane ground_plane = simulator.GroundPlane();
-        for (int i = 1; i <= n_showers;)
+        OutputWriter writer(output_file, resume, compression, write_queue, results_tree);
+        unique_ptr<EventWriter> events;
+        if (save_events) events.reset(new EventWriter(evt_file, resume, delta_events));
+        if (resume)
         {
-            Shower shower = GenerateShower();
-            Reconstructor::Result result = RunSingleShower(shower, to_string(i));
-            if (!result.triggered) continue;
-            cout << "Shower " << i << " finished" << endl;
-            fout << start_seed << "," << i << "," << shower.EnergyeV() << "," << shower.ToString(ground_plane) << ","
-                 << result.ToString(ground_plane) << endl;
-            i++;
+            writer.RemoveShowersAfter(ckpt.next_id);
+            cout << "Resuming from shower " << ckpt.next_id << endl;
         }
+        else
+        {
+            writer.WriteLine(CSVHeader());
+        }
+
+        // Attempts are simulated ahead on the worker threads but consumed in ID order, so sums and output don't depend
+        // on the number of threads. Attempts past the last requested shower are discarded.
+        ShowerProfile run_profile = ShowerProfile();
+        int n_triggered = NumTrials(ckpt) - ckpt.n_untriggered;
+        WorkerPool workers(n_threads);
+        if (stratified) RunStrata(workers, ckpt, output_file, writer, events.get(), run_profile);
+        else if (n_triggered < n_showers && !Settled(ckpt))
+            RunAttempts(workers, ckpt.start_seed, ckpt.next_id, vector<int>(), {this},
+                        [&](int id, vector<Attempt>& attempts) {
+                            int n_before = n_triggered;
+                            n_triggered += WriteAttempt(attempts[0], id, ckpt, writer, events.get(), run_profile);
+                            if (ckpt_every > 0 && n_triggered / ckpt_every != n_before / ckpt_every)
+                                SaveCheckpoint(ckpt, output_file, writer, events.get());
+                            return n_triggered < n_showers && !Settled(ckpt);
+                        });
+        writer.Close();
+        cout << ckpt.n_untriggered << " showers were not triggered, " << ckpt.n_rejected
+             << " of which were rejected before simulation" << endl;
+        if (stratified) PrintStrata(ckpt);
+        else cout << "Weighted fraction of showers triggered: "
+                  << (NumTrials(ckpt) == 0 ? 0.0 : ckpt.trig_weight / NumTrials(ckpt)) << endl;
+        cout << monitor.Summary(ckpt.monitor_stats) << endl;
+        if (Settled(ckpt)) cout << "Stopped because every monitored estimate converged" << endl;
+        cout << run_profile.funnel.Summary() << endl;
+        if (ShowerProfile::enabled) cout << run_profile.Summary() << endl;
     }
 
-    Reconstructor::Result MonteCarlo::RunSingleShower(Shower shower, string ident) const
+    void MonteCarlo::PerformSweep(const ptree& config, const vector<string>& overlays, string output_file)
+    {
+        // Overlays are grouped by everything which the simulation might read, in the order they were given.
+        vector<ptree> configs = vector<ptree>();
+        vector<string> keys = vector<string>();
+        vector<vector<int>> groups = vector<vector<int>>();
+        for (size_t i = 0; i < overlays.size(); i++)
+        {
+            ptree overlaid = config;
+            Utility::ApplyOverlay(overlaid, Utility::ParseXMLFile(overlays[i]).get_child("config"));
+            configs.push_back(overlaid);
+            overlaid.erase("triggering");
+            overlaid.erase("convergence");
+            overlaid.get_child("simulation").erase("pre_trigger");
+            stringstream key = stringstream();
+            write_xml(key, overlaid);
+            size_t group = find(keys.begin(), keys.end(), key.str()) - keys.begin();
+            if (group == keys.size())
+            {
+                keys.push_back(key.str());
+                groups.emplace_back();
+            }
+            groups[group].push_back((int) i);
+        }
+
+        unsigned int start_seed = gRandom->GetSeed();
+        for (const vector<int>& group : groups)
+        {
+            vector<unique_ptr<MonteCarlo>> members = vector<unique_ptr<MonteCarlo>>();
+            vector<const MonteCarlo*> recons = vector<const MonteCarlo*>();
+            vector<string> names = vector<string>();
+            for (int i : group)
+            {
+                members.emplace_back(new MonteCarlo(configs[i]));
+                recons.push_back(members.back().get());
+                string name = overlays[i].substr(overlays[i].find_last_of('/') + 1);
+                names.push_back(output_file + "_" + name.substr(0, name.find_last_of('.')));
+            }
+            const MonteCarlo& leader = *members[0];
+            if (leader.stratified) throw runtime_error("Stratified runs can't be swept.");
+            cout << "Simulating once for " << names.size() << " configurations:";
+            for (string& name : names)
+                cout << " " << name;
+            cout << endl;
+
+            vector<unique_ptr<OutputWriter>> writers = vector<unique_ptr<OutputWriter>>();
+            vector<Checkpoint> ckpts = vector<Checkpoint>(members.size());
+            vector<ShowerProfile> profiles = vector<ShowerProfile>(members.size());
+            vector<int> n_triggered = vector<int>(members.size(), 0);
+            for (size_t m = 0; m < members.size(); m++)
+            {
+                writers.emplace_back(new OutputWriter(names[m], false, members[m]->compression,
+                                                      members[m]->write_queue, members[m]->results_tree));
+                writers[m]->WriteLine(CSVHeader());
+                ckpts[m].start_seed = start_seed;
+            }
+
+            // Each member consumes showers in ID order until it has enough, exactly as a separate run would.
+            WorkerPool workers(leader.n_threads);
+            leader.RunAttempts(workers, start_seed, leader.id_offset + 1, vector<int>(), recons,
+                               [&](int id, vector<Attempt>& attempts) {
+                                   bool done = true;
+                                   for (size_t m = 0; m < members.size(); m++)
+                                   {
+                                       const MonteCarlo& member = *members[m];
+                                       if (n_triggered[m] >= member.n_showers || member.Settled(ckpts[m])) continue;
+                                       n_triggered[m] += member.WriteAttempt(attempts[m], id, ckpts[m], *writers[m],
+                                                                             nullptr, profiles[m]);
+                                       if (n_triggered[m] < member.n_showers && !member.Settled(ckpts[m]))
+                                           done = false;
+                                   }
+                                   return !done;
+                               });
+            for (size_t m = 0; m < members.size(); m++)
+            {
+                writers[m]->Close();
+                cout << names[m] << ": " << ckpts[m].n_untriggered << " showers were not triggered, "
+                     << ckpts[m].n_rejected << " of which were rejected before simulation" << endl;
+                cout << members[m]->monitor.Summary(ckpts[m].monitor_stats) << endl;
+            }
+        }
+    }
+
+    Reconstructor::Result MonteCarlo::RunSingleShower(Shower shower, string ident, PlotList& plots,
+                                                      EventWriter* events, ShowerProfile* profile,
+                                                      unsigned int seed) const
     {
         PhotonCount data;
         try
         {
-            data = simulator.SimulateShower(shower);
+            unsigned int simulate_seed = seed == 0 ? 0 : Utility::DeriveSeed(seed, simulate_stage);
+            data = simulator.SimulateShower(shower, profile, simulate_seed);
         }
         catch (out_of_range& err)
         {
@@ -63,46 +332,165 @@ namespace cherenkov_simulator
             cout << "Skipping this shower..." << endl;
             return Reconstructor::Result();
         }
+        if (profile != nullptr) AddFunnelPlot(profile->funnel, ident, plots);
         if (data.Empty()) return Reconstructor::Result();
+        if (events != nullptr) events->Write(ident, shower, data);
+        return ReconstructShower(shower, data, ident, plots, profile, seed);
+    }
+
+    Reconstructor::Result MonteCarlo::RunSingleShower(Shower shower, string ident) const
+    {
+        PlotList plots = PlotList();
+        Reconstructor::Result result = RunSingleShower(shower, ident, plots);
+        for (auto& plot : plots)
+            plot.second->Write(plot.first.c_str());
+        return result;
+    }
 
-        TH2I befor_noise_pixl = Analysis::MakePixlProfile(data, ident + "_befor_noise_pixl");
-        TGraph befor_noise_time = Analysis::MakeTimeProfile(data);
-        reconstructor.AddNoise(data);
-        TH2I after_noise_pixl = Analysis::MakePixlProfile(data, ident + "_after_noise_pixl");
-        TGraph after_noise_time = Analysis::MakeTimeProfile(data);
-        reconstructor.ClearNoise(data);
-        TH2I after_clear_pixl = Analysis::MakePixlProfile(data, ident + "_after_clear_pixl");
-        TGraph after_clear_time = Analysis::MakeTimeProfile(data);
-
-        Reconstructor::Result result = reconstructor.Reconstruct(data);
-        if (!result.triggered) return Reconstructor::Result();
-
-        befor_noise_pixl.Write();
-        befor_noise_time.Write((ident + "_befor_noise_time").c_str());
-        after_noise_pixl.Write();
-        after_noise_time.Write((ident + "_after_noise_time").c_str());
-        after_clear_pixl.Write();
-        after_clear_time.Write((ident + "_after_clear_time").c_str());
+    Reconstructor::Result MonteCarlo::ReconstructShower(Shower shower, PhotonCount data, string ident,
+                                                        PlotList& plots, ShowerProfile* profile,
+                                                        unsigned int seed, int realization) const
+    {
+        DiagLevel level = DiagnosticLevel(ident);
+        size_t n_plots = plots.size();
+        AddSignalPlots(data, ident + "_befor_noise", level, plots);
+        {
+            PROFILE_STAGE(profile, noise);
+            if (seed != 0) Utility::Rng().SetSeed(NoiseSeed(seed, realization));
+            reconstructor.AddNoise(data);
+        }
+        AddSignalPlots(data, ident + "_after_noise", level, plots);
+        {
+            PROFILE_STAGE(profile, clear);
+            reconstructor.ClearNoise(data);
+        }
+        AddSignalPlots(data, ident + "_after_clear", level, plots);
+
+        Reconstructor::Result result;
+        {
+            PROFILE_STAGE(profile, reconstruct);
+            result = reconstructor.Reconstruct(data);
+        }
+        if (!result.triggered)
+        {
+            plots.resize(n_plots);
+            return Reconstructor::Result();
+        }
+        if (level == DiagLevel::none) return result;
 
         Plane ground_plane = simulator.GroundPlane();
-        shower.Direction().Write((ident + "_orig_direction").c_str());
-        shower.PlaneImpact(ground_plane).Write((ident + "_orig_gnd_impact").c_str());
-        result.mono_recon.Direction().Write((ident + "_mono_direction").c_str());
-        result.mono_recon.PlaneImpact(ground_plane).Write((ident + "_mono_gnd_impact").c_str());
-        result.chkv_recon.Direction().Write((ident + "_chkv_direction").c_str());
-        result.chkv_recon.PlaneImpact(ground_plane).Write((ident + "_chkv_gnd_impact").c_str());
+        plots.emplace_back(ident + "_orig_direction", unique_ptr<TObject>(new TVector3(shower.Direction())));
+        plots.emplace_back(ident + "_orig_gnd_impact",
+                           unique_ptr<TObject>(new TVector3(shower.PlaneImpact(ground_plane))));
+        plots.emplace_back(ident + "_mono_direction", unique_ptr<TObject>(new TVector3(result.mono_recon.Direction())));
+        plots.emplace_back(ident + "_mono_gnd_impact",
+                           unique_ptr<TObject>(new TVector3(result.mono_recon.PlaneImpact(ground_plane))));
+        plots.emplace_back(ident + "_chkv_direction", unique_ptr<TObject>(new TVector3(result.chkv_recon.Direction())));
+        plots.emplace_back(ident + "_chkv_gnd_impact",
+                           unique_ptr<TObject>(new TVector3(result.chkv_recon.PlaneImpact(ground_plane))));
         return result;
     }
 
+    void MonteCarlo::ReconstructEvents(string event_file, string output_file) const
+    {
+        EventReader reader = EventReader(event_file);
+        OutputWriter writer(output_file, false, compression, write_queue, results_tree);
+        unsigned int start_seed = gRandom->GetSeed();
+        writer.WriteLine(CSVHeader());
+
+        ShowerProfile run_profile = ShowerProfile();
+        Plane ground_plane = simulator.GroundPlane();
+        string ident;
+        Shower shower;
+        PhotonCount data;
+        int n_untriggered = 0;
+        while (reader.Next(ident, shower, data))
+        {
+            int id = IdentNumber(ident);
+            unsigned int seed = id < 0 ? Utility::DeriveSeed(start_seed, (long) hash<string>()(ident))
+                                       : ShowerSeed(start_seed, id);
+            for (int r = 0; r < n_noise; r++)
+            {
+                chrono::steady_clock::time_point start = chrono::steady_clock::now();
+                PlotList plots = PlotList();
+                ShowerProfile profile = ShowerProfile();
+                Reconstructor::Result result = ReconstructShower(shower, data, RealizationIdent(ident, r), plots,
+                                                                 &profile, seed, r);
+                chrono::duration<double> time = chrono::steady_clock::now() - start;
+                run_profile.Add(profile);
+                if (!result.triggered)
+                {
+                    n_untriggered++;
+                    continue;
+                }
+                cout << "Shower " << RealizationIdent(ident, r) << " finished" << endl;
+                stringstream line = stringstream();
+                line << start_seed << "," << ident << "," << shower.EnergyeV() << "," << shower.ToString(ground_plane)
+                     << "," << result.ToString(ground_plane) << ",1," << r;
+                if (ShowerProfile::enabled) line << "," << profile.ToString();
+                writer.WriteLine(line.str());
+                writer.WriteResult(ResultRow(start_seed, id, shower, result, ground_plane, time.count(), 1.0, r));
+                writer.WritePlots(move(plots));
+            }
+        }
+        writer.Close();
+        cout << n_untriggered << " showers were not triggered" << endl;
+        if (ShowerProfile::enabled) cout << run_profile.Summary() << endl;
+    }
+
+    void MonteCarlo::IndexEvents(string event_file, string index_file)
+    {
+        EventReader reader = EventReader(event_file);
+        IndexedEventWriter writer(index_file);
+        string ident;
+        Shower shower;
+        PhotonCount data;
+        while (reader.Next(ident, shower, data))
+            writer.Write(ident, shower, data);
+        writer.Close();
+    }
+
     Shower MonteCarlo::GenerateShower() const
     {
-        double zenith = Utility::RandCosine();
-        double azmuth = gRandom->Uniform(TwoPi());
+        double weight;
+        return GenerateShower(weight);
+    }
+
+    Shower MonteCarlo::GenerateShower(double& weight) const
+    {
+        return GenerateShower(RandomPoint(), weight);
+    }
+
+    Shower MonteCarlo::GenerateShower(const Double1D& uniforms, double& weight) const
+    {
+        Stratum full_range = {"all", energy_min, energy_max, impact_min, impact_max, 0, PiOver2(), 0};
+        return GenerateShower(uniforms, full_range, weight);
+    }
+
+    Shower MonteCarlo::GenerateShower(const Double1D& uniforms, const Stratum& stratum, double& weight) const
+    {
+        // The zenith distribution function of either density is a power of the sine, so the uniform is rescaled onto
+        // the part of it which falls within the stratum.
+        double prop_lo = Power(Sin(stratum.zenith_min), zenith_prop + 1);
+        double prop_hi = Power(Sin(stratum.zenith_max), zenith_prop + 1);
+        double phys_lo = Sin(stratum.zenith_min);
+        double phys_hi = Sin(stratum.zenith_max);
+
+        double energy = Utility::PowerQuantile(uniforms[0], stratum.energy_min, stratum.energy_max, energy_prop);
+        double im_par = Utility::PowerQuantile(uniforms[1], stratum.impact_min, stratum.impact_max, impact_prop);
+        double zenith = Utility::CosineQuantile(prop_lo + uniforms[2] * (prop_hi - prop_lo), zenith_prop);
+        double im_ang = TwoPi() * uniforms[3];
+        double azmuth = TwoPi() * uniforms[4];
         TVector3 axis = TVector3(sin(zenith) * cos(azmuth), sin(zenith) * sin(azmuth), -cos(zenith));
 
-        double im_par = Utility::RandLinear(impact_min, impact_max);
-        double im_ang = gRandom->Uniform(TwoPi());
-        double energy = Utility::RandPower(energy_min, energy_max, energy_pow);
+        // Physically, the zenith angle is cosine weighted, the impact point is uniform in area (a linear impact
+        // parameter), and the energy follows energy_pow.
+        weight = Utility::CosineDensity(zenith) / Utility::CosineDensity(zenith, zenith_prop) *
+                 (prop_hi - prop_lo) / (phys_hi - phys_lo);
+        weight *= Utility::PowerDensity(im_par, stratum.impact_min, stratum.impact_max, 1.0) /
+                  Utility::PowerDensity(im_par, stratum.impact_min, stratum.impact_max, impact_prop);
+        weight *= Utility::PowerDensity(energy, stratum.energy_min, stratum.energy_max, energy_pow) /
+                  Utility::PowerDensity(energy, stratum.energy_min, stratum.energy_max, energy_prop);
         return GenerateShower(axis, im_par, im_ang, energy);
     }
 
@@ -119,18 +507,345 @@ namespace cherenkov_simulator
         return Shower(energy, elevation, start_pos, axis);
     }
 
+    MonteCarlo::DiagLevel MonteCarlo::DiagnosticLevel(string ident) const
+    {
+        if (diag_level == DiagLevel::none) return DiagLevel::none;
+        int id = IdentNumber(ident);
+        if (id < 0) return diag_level;
+        bool selected = (diag_every > 0 && id % diag_every == 0) || diag_ids.count(id) > 0;
+        return selected ? diag_level : DiagLevel::none;
+    }
+
+    unsigned int MonteCarlo::ShowerSeed(unsigned int run_seed, int id)
+    {
+        return Utility::DeriveSeed(run_seed, id);
+    }
+
+    Double1D MonteCarlo::HaltonPoint(unsigned int run_seed, int id)
+    {
+        // Shower IDs are positive, so this scrambling seed is never the seed of a shower.
+        unsigned int scramble = Utility::DeriveSeed(run_seed, -1);
+        Double1D point = Double1D(5);
+        for (int dim = 0; dim < 5; dim++)
+            point[dim] = Utility::Halton(id, dim, scramble);
+        return point;
+    }
+
+    Double1D MonteCarlo::RandomPoint()
+    {
+        Double1D point = Double1D(5);
+        for (double& u : point)
+            u = Utility::Rng().Rndm();
+        return point;
+    }
+
+    vector<MonteCarlo::Attempt> MonteCarlo::RunAttempt(unsigned int run_seed, int id, int stratum,
+                                                       const vector<const MonteCarlo*>& recons) const
+    {
+        // Keep histograms made on this thread out of the current directory, which may be shared with other threads.
+        TDirectory::TContext context(nullptr);
+        vector<Attempt> attempts = vector<Attempt>(recons.size());
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        try
+        {
+            unsigned int seed = ShowerSeed(run_seed, id);
+            Utility::Rng().SetSeed(Utility::DeriveSeed(seed, generate_stage));
+            Double1D point = halton ? HaltonPoint(run_seed, id) : RandomPoint();
+            double weight = 1.0;
+            Shower shower = GenerateShower(point, strata[stratum], weight);
+
+            // Each reconstruction applies its own margin and trigger threshold to the estimate, and the shower is
+            // simulated if any of them might trigger.
+            double estimate = -1.0;
+            bool simulate = false;
+            for (size_t i = 0; i < recons.size(); i++)
+            {
+                attempts[i].shower = shower;
+                attempts[i].weight = weight;
+                attempts[i].stratum = stratum;
+                if (recons[i]->pre_trigger > 0)
+                {
+                    if (estimate < 0) estimate = simulator.EstimatePeakSignal(shower);
+                    attempts[i].rejected = estimate * recons[i]->pre_trigger < recons[i]->trigger_signal;
+                }
+                if (!attempts[i].rejected) simulate = true;
+            }
+            if (!simulate) return attempts;
+
+            ShowerProfile profile = ShowerProfile();
+            PhotonCount data;
+            bool skipped = false;
+            try
+            {
+                data = simulator.SimulateShower(shower, &profile, Utility::DeriveSeed(seed, simulate_stage));
+            }
+            catch (out_of_range& err)
+            {
+                cout << err.what() << endl;
+                cout << "Skipping this shower..." << endl;
+                skipped = true;
+            }
+            for (Attempt& attempt : attempts)
+            {
+                if (attempt.rejected) continue;
+                attempt.profile = profile;
+                if (!skipped) AddFunnelPlot(profile.funnel, to_string(id), attempt.plots);
+            }
+            if (skipped || data.Empty()) return attempts;
+
+            // Every reconstruction draws the same noise, since the noise seed only depends on the shower and the
+            // realization.
+            double sim_seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            for (size_t i = 0; i < recons.size(); i++)
+            {
+                if (attempts[i].rejected) continue;
+                chrono::steady_clock::time_point recon_start = chrono::steady_clock::now();
+                for (int r = 0; r < n_noise; r++)
+                    attempts[i].results.push_back(recons[i]->ReconstructShower(
+                            shower, data, RealizationIdent(to_string(id), r), attempts[i].plots, &attempts[i].profile,
+                            seed, r));
+                chrono::duration<double> recon_time = chrono::steady_clock::now() - recon_start;
+                attempts[i].seconds = sim_seconds + recon_time.count();
+            }
+            attempts[0].has_data = save_events;
+            if (save_events) attempts[0].data = move(data);
+        }
+        catch (...)
+        {
+            for (Attempt& attempt : attempts)
+                attempt.error = current_exception();
+        }
+        return attempts;
+    }
+
+    void MonteCarlo::RunAttempts(WorkerPool& workers, unsigned int run_seed, int first, const vector<int>& stratum_ids,
+                                 const vector<const MonteCarlo*>& recons,
+                                 const function<bool(int, vector<Attempt>&)>& write) const
+    {
+        int end = stratum_ids.empty() ? numeric_limits<int>::max() : first + (int) stratum_ids.size();
+        deque<future<vector<Attempt>>> queued = deque<future<vector<Attempt>>>();
+        int next = first;
+        for (int id = first; id < end; id++)
+        {
+            for (; next < end && (int) queued.size() < workers.Depth(); next++)
+            {
+                int stratum = stratum_ids.empty() ? 0 : stratum_ids[next - first];
+                queued.push_back(workers.Submit(function<vector<Attempt>()>([this, run_seed, next, stratum, recons]() {
+                    return RunAttempt(run_seed, next, stratum, recons);
+                })));
+            }
+            vector<Attempt> attempts = queued.front().get();
+            queued.pop_front();
+            if (!write(id, attempts)) return;
+        }
+    }
+
+    int MonteCarlo::WriteAttempt(Attempt& attempt, int id, Checkpoint& ckpt, OutputWriter& writer,
+                                 EventWriter* events, ShowerProfile& run_profile) const
+    {
+        if (attempt.error) rethrow_exception(attempt.error);
+        run_profile.Add(attempt.profile);
+        if (events != nullptr && attempt.has_data) events->Write(to_string(id), attempt.shower, attempt.data);
+        ckpt.next_id = id + 1;
+        if (stratified) ckpt.stratum_attempts[attempt.stratum]++;
+
+        // Showers which weren't reconstructed count as untriggered in every realization.
+        Plane ground_plane = simulator.GroundPlane();
+        int n_written = 0;
+        for (int r = 0; r < n_noise; r++)
+        {
+            if (r >= (int) attempt.results.size() || !attempt.results[r].triggered)
+            {
+                ckpt.n_untriggered++;
+                if (attempt.rejected) ckpt.n_rejected++;
+                ResultRow row = ResultRow();
+                row.weight = attempt.weight;
+                ConvergenceMonitor::Add(ckpt.monitor_stats, row);
+                continue;
+            }
+            const Reconstructor::Result& result = attempt.results[r];
+            cout << "Shower " << RealizationIdent(to_string(id), r) << " finished" << endl;
+            stringstream line = stringstream();
+            line << ckpt.start_seed << "," << id << "," << attempt.shower.EnergyeV() << ","
+                 << attempt.shower.ToString(ground_plane) << "," << result.ToString(ground_plane) << ","
+                 << attempt.weight << "," << r;
+            if (ShowerProfile::enabled) line << "," << attempt.profile.ToString();
+            writer.WriteLine(line.str());
+            ResultRow row = ResultRow(ckpt.start_seed, id, attempt.shower, result, ground_plane, attempt.seconds,
+                                      attempt.weight, r);
+            writer.WriteResult(row);
+            n_written++;
+
+            ckpt.trig_weight += attempt.weight;
+            if (stratified) ckpt.stratum_stats[attempt.stratum].Add((row.mono_im - row.im) / row.im, attempt.weight);
+            ConvergenceMonitor::Add(ckpt.monitor_stats, row);
+            if (monitor.ReportDue((id - 1 - id_offset) * n_noise + r + 1 - ckpt.n_untriggered))
+                cout << monitor.Summary(ckpt.monitor_stats) << endl;
+        }
+        writer.WritePlots(move(attempt.plots));
+        return n_written;
+    }
+
+    int MonteCarlo::NumTrials(const Checkpoint& ckpt) const
+    {
+        return (ckpt.next_id - 1 - id_offset) * n_noise;
+    }
+
+    string MonteCarlo::RealizationIdent(string ident, int realization)
+    {
+        return realization == 0 ? ident : ident + "_" + to_string(realization);
+    }
+
+    unsigned int MonteCarlo::NoiseSeed(unsigned int seed, int realization)
+    {
+        unsigned int noise_seed = Utility::DeriveSeed(seed, noise_stage);
+        return realization == 0 ? noise_seed : Utility::DeriveSeed(noise_seed, realization);
+    }
+
+    bool MonteCarlo::Settled(const Checkpoint& ckpt) const
+    {
+        return monitor.AutoStop() && monitor.Converged(ckpt.monitor_stats);
+    }
+
+    bool MonteCarlo::StratumDone(const Checkpoint& ckpt, int stratum) const
+    {
+        const RunningStat& stats = ckpt.stratum_stats[stratum];
+        if (stats.Count() >= n_showers) return true;
+        if (max_attempts > 0 && ckpt.stratum_attempts[stratum] >= max_attempts) return true;
+        return stats.Count() >= min_showers && stats.StdError() <= strata[stratum].target;
+    }
+
+    void MonteCarlo::RunStrata(WorkerPool& workers, Checkpoint& ckpt, string output_file, OutputWriter& writer,
+                               EventWriter* events, ShowerProfile& run_profile) const
+    {
+        // A round is allocated from the state at its start and checkpoints are only saved between rounds, so a
+        // resumed run allocates exactly the same rounds as an uninterrupted one. As in an unstratified run, a
+        // checkpoint is saved once every ckpt_every triggered showers, at the end of the round which reaches them.
+        int n_triggered = NumTrials(ckpt) - ckpt.n_untriggered;
+        while (true)
+        {
+            vector<int> round = vector<int>();
+            for (int i = 0; i < (int) strata.size(); i++)
+                if (!StratumDone(ckpt, i)) round.insert(round.end(), round_size, i);
+            if (round.empty() || Settled(ckpt)) return;
+            int n_before = n_triggered;
+            RunAttempts(workers, ckpt.start_seed, ckpt.next_id, round, {this}, [&](int id, vector<Attempt>& attempts) {
+                n_triggered += WriteAttempt(attempts[0], id, ckpt, writer, events, run_profile);
+                return true;
+            });
+            if (ckpt_every > 0 && n_triggered / ckpt_every != n_before / ckpt_every)
+                SaveCheckpoint(ckpt, output_file, writer, events);
+        }
+    }
+
+    void MonteCarlo::PrintStrata(const Checkpoint& ckpt) const
+    {
+        // Weights are relative to the distribution within each stratum, so fractions are only comparable per stratum.
+        // They are combined in proportion to the attempts each stratum was allocated.
+        int n_attempts = 0;
+        for (int attempts : ckpt.stratum_attempts)
+            n_attempts += attempts;
+        double combined = 0;
+        for (size_t i = 0; i < strata.size(); i++)
+        {
+            const RunningStat& stats = ckpt.stratum_stats[i];
+            int attempts = ckpt.stratum_attempts[i];
+            double fraction = attempts == 0 ? 0.0 : stats.SumWeights() / (attempts * n_noise);
+            if (n_attempts > 0) combined += fraction * attempts / n_attempts;
+            cout << "Stratum " << strata[i].name << ": " << attempts << " attempts, " << stats.Count()
+                 << " triggered, weighted fraction triggered " << fraction << ", relative impact parameter error "
+                 << stats.Mean() << " +/- " << stats.StdError() << endl;
+        }
+        cout << "Weighted fraction of showers triggered, combined by stratum allocation: " << combined << endl;
+    }
+
+    string MonteCarlo::CSVHeader()
+    {
+        string header = "Seed,ID,Energy," + Shower::Header() + ", " + Reconstructor::Result::Header() +
+                        ",Weight,Realization";
+        if (ShowerProfile::enabled) header += "," + ShowerProfile::Header();
+        return header;
+    }
+
+    int MonteCarlo::IdentNumber(string ident)
+    {
+        try
+        {
+            return stoi(ident);
+        }
+        catch (logic_error&)
+        {
+            return -1;
+        }
+    }
+
+    void MonteCarlo::AddFunnelPlot(const PhotonFunnel& funnel, string ident, PlotList& plots)
+    {
+        TH2I* plot = new TH2I(Analysis::MakeFunnelPlot(funnel, ident + "_funnel"));
+        plot->SetDirectory(nullptr);
+        plots.emplace_back(ident + "_funnel", unique_ptr<TObject>(plot));
+    }
+
+    void MonteCarlo::AddSignalPlots(const PhotonCount& data, string prefix, DiagLevel level, PlotList& plots)
+    {
+        if (level == DiagLevel::none) return;
+        plots.emplace_back(prefix + "_time", unique_ptr<TObject>(new TGraph(Analysis::MakeTimeProfile(data))));
+        if (level != DiagLevel::full) return;
+
+        // Keep the histogram out of the current directory, since it's owned by the list.
+        TH2I* pixl = new TH2I(Analysis::MakePixlProfile(data, prefix + "_pixl"));
+        pixl->SetDirectory(nullptr);
+        plots.emplace_back(prefix + "_pixl", unique_ptr<TObject>(pixl));
+    }
+
+    void MonteCarlo::SaveCheckpoint(Checkpoint& ckpt, string output_file, OutputWriter& writer,
+                                    EventWriter* events) const
+    {
+        ckpt.csv_offset = writer.Sync();
+        if (events != nullptr) ckpt.evt_offset = events->Flush();
+        ckpt.Write(output_file + "_ckpt.xml");
+    }
+
     int MonteCarlo::Run(int argc, const char* argv[])
     {
+        // Separate flags from the positional arguments (output file, config file, seed).
+        vector<string> args = vector<string>();
+        bool resume = false;
+        string event_file;
+        string index_from;
+        vector<string> overlays = vector<string>();
+        for (int i = 1; i < argc; i++)
+        {
+            if (string(argv[i]) == "--resume") resume = true;
+            else if (string(argv[i]) == "--reconstruct" && i + 1 < argc) event_file = string(argv[++i]);
+            else if (string(argv[i]) == "--index" && i + 1 < argc) index_from = string(argv[++i]);
+            else if (string(argv[i]) == "--overlay" && i + 1 < argc) overlays.push_back(string(argv[++i]));
+            else args.push_back(string(argv[i]));
+        }
+
         string output_file = "Output";
         string config_file = "Config.xml";
-        if (argc > 1) output_file = string(argv[1]);
-        if (argc > 2) config_file = string(argv[2]);
+        if (args.size() > 0) output_file = args[0];
+        if (args.size() > 1) config_file = args[1];
+        // Output is written to ROOT files from a separate thread, and showers may be simulated on several. Fit
+        // functions are kept out of the global list, since every thread names its function the same way, and fits
+        // use Minuit2, since the default TMinuit shares one global instance between threads.
+        ROOT::EnableThreadSafety();
+        TF1::DefaultAddToGlobalList(false);
+        ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2");
         try
         {
+            if (!index_from.empty())
+            {
+                IndexEvents(index_from, output_file + ".idx");
+                return 0;
+            }
             ptree config = Utility::ParseXMLFile(config_file).get_child("config");
             if (config.get<bool>("simulation.time_seed")) gRandom->SetSeed();
-            if (argc > 3) gRandom->SetSeed(stoul(argv[3]));
-            MonteCarlo(config).PerformMonteCarlo(output_file);
+            if (args.size() > 2) gRandom->SetSeed(stoul(args[2]));
+            if (!overlays.empty()) PerformSweep(config, overlays, output_file);
+            else if (!event_file.empty()) MonteCarlo(config).ReconstructEvents(event_file, output_file);
+            else MonteCarlo(config).PerformMonteCarlo(output_file, resume);
             return 0;
         }
         catch (runtime_error& err)
@@ -7,14 +7,24 @@
 #ifndef MONTE_CARLO_H
 #define MONTE_CARLO_H
 
+#include <exception>
+#include <functional>
+#include <set>
 #include <boost/property_tree/ptree.hpp>
 #include <TF1.h>
 #include <TRandom3.h>
 
+#include "Analysis.h"
+#include "EventIndex.h"
+#include "EventStore.h"
 #include "Geometric.h"
+#include "OutputWriter.h"
+#include "Profiler.h"
 #include "Reconstructor.h"
 #include "Simulator.h"
+#include "Statistics.h"
 #include "Utility.h"
+#include "WorkerPool.h"
 
 namespace cherenkov_simulator
 {
@@ -27,6 +37,68 @@ namespace cherenkov_simulator
     {
     public:
 
+        /*
+         * The amount of diagnostic output written for a shower. Summary output consists of the time profiles and the
+         * true and reconstructed geometry, and full output adds the pixel maps.
+         */
+        enum class DiagLevel
+        {
+            none,
+            summary,
+            full
+        };
+
+        /*
+         * A region of shower parameter space. In a stratified run, each stratum is simulated until the standard error
+         * of its mean relative impact parameter error, (mono_im - im) / im, is below its target.
+         */
+        struct Stratum
+        {
+            std::string name;
+            double energy_min;
+            double energy_max;
+            double impact_min;
+            double impact_max;
+            double zenith_min;
+            double zenith_max;
+            double target;
+        };
+
+        /*
+         * The state of a partially completed Monte Carlo run. PerformMonteCarlo writes one of these periodically so
+         * that an interrupted run can be resumed where it left off rather than from the beginning. Every random draw
+         * is derived from the start seed and the shower ID, so no RNG state needs to be saved.
+         */
+        struct Checkpoint
+        {
+            int next_id;
+            int n_untriggered;
+            int n_rejected;
+            double trig_weight;
+            unsigned int start_seed;
+            long csv_offset;
+            long evt_offset;
+            std::vector<int> stratum_attempts;
+            std::vector<RunningStat> stratum_stats;
+            std::vector<RunningStat> monitor_stats;
+
+            /*
+             * The default constructor. Describes a run which has not yet started.
+             */
+            Checkpoint();
+
+            /*
+             * Writes the checkpoint to an XML file. The file is first written under a temporary name and then renamed,
+             * so an interruption during the write leaves the previous checkpoint intact.
+             */
+            void Write(std::string filename) const;
+
+            /*
+             * Reads a checkpoint written by Write(). Throws a runtime_error if the file can't be read.
+             */
+            static Checkpoint Read(std::string filename);
+        };
+
         /*
          * Constructs the MonteCarlo by copying user-specified parameters from the parsed XML file.
          * TODO: Method should throw exceptions if parameters are out of range
@@ -36,32 +108,117 @@ namespace cherenkov_simulator
         /*
          * Performs the overall Monte Carlo simulation and writes results to a CSV file. A ROOT file is also written
          * which, for each shower, contains plots of the initial shower track, the post noise shower track, and the post
-         * noise removal shower track.
+         * noise removal shower track. Each row is a triggered noise draw of a shower, followed by its weight (see
+         * GenerateShower), and the run stops after n_showers rows or once every monitored estimate converges. The
+         * output doesn't depend on the number of threads, and if resume is true the run continues from the last
+         * checkpoint as if it had never stopped. The options are described in Config.xml.
          */
-        void PerformMonteCarlo(std::string output_file) const;
+        void PerformMonteCarlo(std::string output_file, bool resume = false) const;
 
         /*
-         * Simulates and attempts reconstruction on a single shower, passed as a parameter. Writes various plots to the
-         * current open file handle, and returns a Reconstructor::Result with reconstructed parameters. It is assumed
-         * that a ROOT file will have been opened before calling this method.
+         * Runs a Monte Carlo for each of the overlay files applied on top of the configuration (see
+         * Utility::ApplyOverlay). The output of each has the same format as PerformMonteCarlo and is written to
+         * output_file followed by an underscore and the name of the overlay file. Overlays which differ only in their
+         * triggering and convergence sections and pre_trigger form a group, and each shower of a group is simulated
+         * once and then reconstructed separately for each overlay. Every group uses the same run seed, so showers with
+         * the same ID are the same shower and share their simulation random numbers wherever the parameters allow. The
+         * output of each overlay is the same as that of a separate PerformMonteCarlo with the same seed, apart from the
+         * timing. Stratified runs, checkpoints, and saved events aren't supported.
+         */
+        static void PerformSweep(const boost::property_tree::ptree& config, const std::vector<std::string>& overlays,
+                                 std::string output_file);
+
+        /*
+         * Simulates and attempts reconstruction on a single shower, passed as a parameter. If the shower triggers and
+         * is selected by DiagnosticLevel(), diagnostic plots are appended to the list for the caller to write. If a
+         * profile is passed, the photon funnel of every simulated shower is also appended. Returns a
+         * Reconstructor::Result with reconstructed parameters. If an EventWriter is passed, the noiseless PhotonCount
+         * and the true Shower are also written to it so they can be reconstructed again later. If a profile is passed,
+         * the time spent in each stage is added to it. If a nonzero seed is passed, the simulation and the noise draw
+         * from seeds derived from it rather than from the current state of the RNG.
+         */
+        Reconstructor::Result RunSingleShower(Shower shower, std::string ident, PlotList& plots,
+                                              EventWriter* events = nullptr, ShowerProfile* profile = nullptr,
+                                              unsigned int seed = 0) const;
+
+        /*
+         * Same as above, but writes the diagnostic plots to the current open file handle. It is assumed that a ROOT
+         * file will have been opened before calling this method.
          */
         Reconstructor::Result RunSingleShower(Shower shower, std::string ident) const;
 
+        /*
+         * Adds noise to the noiseless signal of a shower, clears the noise, and attempts reconstruction. Plots are
+         * appended to the list in the same way as RunSingleShower, and are only built if they will be written. If a
+         * profile is passed, the time spent in each stage is added to it. If a nonzero seed is passed, the RNG is
+         * reseeded from it and the realization number before the noise is drawn, so each realization of a shower gets
+         * independent noise.
+         */
+        Reconstructor::Result ReconstructShower(Shower shower, PhotonCount data, std::string ident, PlotList& plots,
+                                                ShowerProfile* profile = nullptr, unsigned int seed = 0,
+                                                int realization = 0) const;
+
+        /*
+         * Reconstructs every event in a file written during an earlier PerformMonteCarlo, using the triggering and
+         * reconstruction parameters of this MonteCarlo. Writes a CSV file and a ROOT file in the same format as
+         * PerformMonteCarlo. No showers are simulated, so this runs at reconstruction speed. The noise of an event with
+         * a numeric identifier is seeded in the same way as in PerformMonteCarlo.
+         */
+        void ReconstructEvents(std::string event_file, std::string output_file) const;
+
+        /*
+         * Copies every event in a file written by an EventWriter into an indexed event file, which can be memory-mapped
+         * for random access to individual events.
+         */
+        static void IndexEvents(std::string event_file, std::string index_file);
+
         /*
          * Generates a Shower with a random position, direction, and energy. Allowed ranges of these parameters are
-         * defined in the configuration file.
+         * defined in the configuration file. Draws from the RNG of the calling thread.
          */
         Shower GenerateShower() const;
 
+        /*
+         * Same as above, but the zenith angle, impact parameter, and energy are drawn from the proposal distributions
+         * set by zenith_prop, impact_prop, and energy_prop. The weight is set to the ratio of the physical density to
+         * the proposal density, so weighted sums over the showers are unbiased. With the default proposals the weight
+         * is one.
+         */
+        Shower GenerateShower(double& weight) const;
+
+        /*
+         * Same as above, but takes the five numbers on (0, 1) which are mapped to the energy, impact parameter, zenith
+         * angle, impact angle, and azimuth, in that order, rather than drawing them from the RNG.
+         */
+        Shower GenerateShower(const Double1D& uniforms, double& weight) const;
+
+        /*
+         * Same as above, but the energy, impact parameter, and zenith angle are restricted to the ranges of a stratum.
+         * The weight is relative to the physical distribution restricted to the same ranges.
+         */
+        Shower GenerateShower(const Double1D& uniforms, const Stratum& stratum, double& weight) const;
+
         /*
          * Constructs a Shower given an axis direction, impact parameter, impact angle (angle of the point of closest
          * approach), and energy.
          */
         Shower GenerateShower(TVector3 axis, double im_par, double im_ang, double energy) const;
 
+        /*
+         * Determines how much diagnostic output should be written for the shower with the specified identifier.
+         * Numeric identifiers receive the configured level if they are a multiple of diag_every or are listed in
+         * diag_ids, and no output otherwise. Other identifiers (such as those of sample events) always receive the
+         * configured level. Shower IDs number every attempt, including untriggered and rejected showers, rather than
+         * only the showers written, so diag_every and diag_ids select attempts and an ID with no row gets no plots.
+         */
+        DiagLevel DiagnosticLevel(std::string ident) const;
+
         /*
          * Parses the output file and configuration file from command line arguments, instantiates the MonteCarlo
-         * object, and runs the PerformMonteCarlo method.
+         * object, and runs the PerformMonteCarlo method. The flag --resume may appear anywhere in the arguments and
+         * causes the run to continue from its last checkpoint. The option --reconstruct <event file> reconstructs
+         * stored events instead of simulating new showers, and --index <event file> converts stored events to an
+         * indexed event file. Each --overlay <overlay file> adds a configuration to a sweep (see PerformSweep).
          */
         static int Run(int argc, const char* argv[]);
 
@@ -69,18 +226,189 @@ namespace cherenkov_simulator
 
         friend class SampleEvents;
 
+        /*
+         * The independent parts of a shower's simulation, each of which draws from its own random stream.
+         */
+        enum RngStage
+        {
+            generate_stage,
+            simulate_stage,
+            noise_stage
+        };
+
+        /*
+         * Everything produced by one attempted shower, held until the showers before it have been written.
+         */
+        struct Attempt
+        {
+            Shower shower;
+            PhotonCount data;
+            bool has_data = false;
+            bool rejected = false;
+            double weight = 1.0;
+            std::vector<Reconstructor::Result> results;
+            PlotList plots;
+            ShowerProfile profile;
+            double seconds = 0;
+            int stratum = 0;
+            std::exception_ptr error;
+        };
+
         int n_showers;
+        int n_threads;
+        int id_offset;
+        double pre_trigger;
+        int n_noise;
+        double trigger_signal;
+        int ckpt_every;
+        bool save_events;
+        bool delta_events;
+        int write_queue;
+        int compression;
+        bool results_tree;
+        DiagLevel diag_level;
+        int diag_every;
+        std::set<int> diag_ids;
         double elevation;
 
         double energy_pow;
+        double energy_prop;
+        double impact_prop;
+        double zenith_prop;
+        bool halton;
         double energy_min;
         double energy_max;
         double impact_min;
         double impact_max;
         double begn_depth;
 
+        bool stratified;
+        int round_size;
+        int min_showers;
+        int max_attempts;
+        std::vector<Stratum> strata;
+
         Simulator simulator;
         Reconstructor reconstructor;
+        ConvergenceMonitor monitor;
+
+        /*
+         * Returns the seed from which every random stream of the specified shower is derived.
+         */
+        static unsigned int ShowerSeed(unsigned int run_seed, int id);
+
+        /*
+         * Returns the point of the scrambled Halton sequence which sets the parameters of the shower with the
+         * specified ID. The scrambling depends only on the run seed, so runs which share a seed but have different
+         * ID offsets draw from disjoint blocks of the same sequence.
+         */
+        static Double1D HaltonPoint(unsigned int run_seed, int id);
+
+        /*
+         * Returns five numbers on (0, 1) drawn from the RNG of the calling thread, for use with GenerateShower.
+         */
+        static Double1D RandomPoint();
+
+        /*
+         * Generates and simulates the shower with the specified ID within the specified stratum, then reconstructs the
+         * noiseless signal n_noise times with each of the listed MonteCarlos, returning one attempt for each. The
+         * results depend only on the run seed, the ID, and the stratum, not on the thread or on any showers simulated
+         * before it. The noiseless signal is kept in the first attempt if save_events is set. A shower is marked as
+         * rejected for each reconstruction whose trigger threshold it can't reach by its own pre-trigger estimate, and
+         * is only simulated if it isn't rejected for all of them. Exceptions are stored in the attempts rather than
+         * thrown.
+         */
+        std::vector<Attempt> RunAttempt(unsigned int run_seed, int id, int stratum,
+                                        const std::vector<const MonteCarlo*>& recons) const;
+
+        /*
+         * Runs attempts with IDs starting at first on the threads of the pool and passes each to write in ID order,
+         * until write returns false. If strata are listed, there is one attempt in each listed stratum, and otherwise
+         * attempts are in the first stratum and continue until write stops them. A few attempts per thread are queued
+         * ahead of the one being written, so no thread waits for a slow shower on another, and those queued after the
+         * last one written are discarded.
+         */
+        void RunAttempts(WorkerPool& workers, unsigned int run_seed, int first, const std::vector<int>& stratum_ids,
+                         const std::vector<const MonteCarlo*>& recons,
+                         const std::function<bool(int, std::vector<Attempt>&)>& write) const;
+
+        /*
+         * Writes the results of an attempt to the output and updates the counts in the checkpoint. Each realization of
+         * the noise counts as a separate trial. Returns the number of realizations which were triggered.
+         */
+        int WriteAttempt(Attempt& attempt, int id, Checkpoint& ckpt, OutputWriter& writer, EventWriter* events,
+                         ShowerProfile& run_profile) const;
+
+        /*
+         * The number of trials (showers times noise realizations) consumed so far.
+         */
+        int NumTrials(const Checkpoint& ckpt) const;
+
+        /*
+         * Returns the identifier of a realization of the noise of a shower, which is the shower identifier for the
+         * first realization and has the realization number appended for the rest.
+         */
+        static std::string RealizationIdent(std::string ident, int realization);
+
+        /*
+         * Returns the seed of the noise of the specified realization of the shower with the specified seed. The first
+         * realization uses the same seed as when only one realization is drawn.
+         */
+        static unsigned int NoiseSeed(unsigned int seed, int realization);
+
+        /*
+         * Determines whether auto_stop is set and every monitored estimate has converged.
+         */
+        bool Settled(const Checkpoint& ckpt) const;
+
+        /*
+         * Determines whether the specified stratum of a stratified run needs no more showers. A stratum is done once
+         * it has min_showers triggered showers and meets its target, has n_showers, or has used max_attempts.
+         */
+        bool StratumDone(const Checkpoint& ckpt, int stratum) const;
+
+        /*
+         * Simulates rounds of showers until every stratum is done. Each round gives round_size attempts to every
+         * stratum which isn't done, so rounds only depend on earlier rounds and not on the number of threads.
+         */
+        void RunStrata(WorkerPool& workers, Checkpoint& ckpt, std::string output_file, OutputWriter& writer,
+                       EventWriter* events, ShowerProfile& run_profile) const;
+
+        /*
+         * Prints the weighted fraction of showers triggered and the impact parameter error of each stratum, and the
+         * fractions combined in proportion to the attempts given to each stratum.
+         */
+        void PrintStrata(const Checkpoint& ckpt) const;
+
+        /*
+         * Returns the header of the CSV output. Profiling columns are included if profiling was compiled in.
+         */
+        static std::string CSVHeader();
+
+        /*
+         * Returns the shower ID stored in an identifier, or -1 if the identifier isn't numeric or is too large.
+         */
+        static int IdentNumber(std::string ident);
+
+        /*
+         * Adds a plot of the fate of the photons traced for a shower to the list of plots. Funnels are written for
+         * every simulated shower, whether or not it triggers, since the showers which lose their photons in the optics
+         * are the ones which don't.
+         */
+        static void AddFunnelPlot(const PhotonFunnel& funnel, std::string ident, PlotList& plots);
+
+        /*
+         * Adds the time profile, and for full output the pixel map, of the current state of the signal to the list of
+         * plots. Names begin with the specified prefix.
+         */
+        static void AddSignalPlots(const PhotonCount& data, std::string prefix, DiagLevel level, PlotList& plots);
+
+        /*
+         * Flushes the output files, records the sizes of the CSV and event files in the checkpoint, and saves the
+         * checkpoint. The ROOT file needs no offset, since objects after the checkpoint are removed by ID.
+         */
+        void SaveCheckpoint(Checkpoint& ckpt, std::string output_file, OutputWriter& writer,
+                            EventWriter* events) const;
     };
 }
 
@@ -0,0 +1,365 @@
+// OutputWriter.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of OutputWriter.h
+
+#include <TList.h>
+#include <TMath.h>
+
+#include "OutputWriter.h"
+
+using namespace std;
+using namespace TMath;
+
+namespace cherenkov_simulator
+{
+    ResultRow::ResultRow()
+    {
+        seed = 0;
+        id = 0;
+        energy = 0;
+        psi = 0;
+        im = 0;
+        gnd = 0;
+        trig = 0;
+        mono_psi = 0;
+        mono_im = 0;
+        mono_gnd = 0;
+        chkv = 0;
+        chkv_psi = 0;
+        chkv_im = 0;
+        chkv_gnd = 0;
+        weight = 1;
+        realization = 0;
+        time = 0;
+    }
+
+    ResultRow::ResultRow(unsigned int seed, int id, Shower shower, Reconstructor::Result result, Plane ground_plane,
+                         double time, double weight, int realization) : ResultRow()
+    {
+        this->seed = seed;
+        this->id = id;
+        this->weight = weight;
+        this->realization = realization;
+        this->time = time;
+        energy = shower.EnergyeV();
+        psi = shower.ImpactAngle() * 180.0 / Pi();
+        im = shower.ImpactParam() / 1e5;
+        gnd = shower.PlaneImpact(ground_plane).Mag() / 1e5;
+
+        trig = result.triggered ? 1 : 0;
+        if (result.triggered)
+        {
+            mono_psi = result.mono_recon.ImpactAngle() * 180.0 / Pi();
+            mono_im = result.mono_recon.ImpactParam() / 1e5;
+            mono_gnd = result.mono_recon.PlaneImpact(ground_plane).Mag() / 1e5;
+        }
+        chkv = result.chkv_tried ? 1 : 0;
+        if (result.chkv_tried)
+        {
+            chkv_psi = result.chkv_recon.ImpactAngle() * 180.0 / Pi();
+            chkv_im = result.chkv_recon.ImpactParam() / 1e5;
+            chkv_gnd = result.chkv_recon.PlaneImpact(ground_plane).Mag() / 1e5;
+        }
+    }
+
+    OutputWriter::OutputWriter(string output_file, bool append, int compression, size_t max_queue,
+                               bool results_tree)
+    {
+        this->max_queue = max_queue > 0 ? max_queue : 1;
+        closing = false;
+        closed = false;
+        n_synced = 0;
+        csv_offset = 0;
+        tree = nullptr;
+
+        fout.open(output_file + ".csv", append ? ios::app : ios::trunc);
+        if (fout.fail())
+            throw runtime_error("The file " + output_file + ".csv could not be opened. Check the path.");
+
+        // Opening a file makes it the current directory. Restore the old one so that histograms created by the caller
+        // are never attached to a file which the writer thread is using.
+        {
+            TDirectory::TContext context;
+            file.reset(new TFile((output_file + ".root").c_str(), append ? "UPDATE" : "RECREATE"));
+        }
+        if (file->IsZombie())
+            throw runtime_error("The file " + output_file + ".root could not be opened. Check the path.");
+        file->SetCompressionLevel(compression);
+
+        if (results_tree)
+        {
+            TDirectory::TContext context(file.get());
+            tree = append ? (TTree*) file->Get("results") : nullptr;
+            bool create = tree == nullptr;
+            if (create) tree = new TTree("results", "Monte Carlo Results");
+            AttachBranches(create);
+        }
+
+        thread = std::thread(&OutputWriter::Loop, this);
+    }
+
+    OutputWriter::~OutputWriter()
+    {
+        try
+        {
+            Close();
+        }
+        catch (exception& err)
+        {
+            cout << err.what() << endl;
+        }
+    }
+
+    void OutputWriter::WriteLine(string line)
+    {
+        Task task = Task();
+        task.kind = Task::Kind::line;
+        task.line = move(line);
+        Push(move(task));
+    }
+
+    void OutputWriter::WriteResult(const ResultRow& row)
+    {
+        if (tree == nullptr) return;
+        Task task = Task();
+        task.kind = Task::Kind::result;
+        task.row = row;
+        Push(move(task));
+    }
+
+    void OutputWriter::WritePlots(PlotList plots)
+    {
+        if (plots.empty()) return;
+        Task task = Task();
+        task.kind = Task::Kind::plots;
+        task.plots = move(plots);
+        Push(move(task));
+    }
+
+    void OutputWriter::RemoveShowersAfter(int first_id)
+    {
+        Task task = Task();
+        task.kind = Task::Kind::prune;
+        task.first_id = first_id;
+        Push(move(task));
+    }
+
+    long OutputWriter::Sync()
+    {
+        Task task = Task();
+        task.kind = Task::Kind::sync;
+        unique_lock<std::mutex> lock(mutex);
+        long target = n_synced + 1;
+        for (const Task& queued : queue)
+            if (queued.kind == Task::Kind::sync) target++;
+        lock.unlock();
+
+        Push(move(task));
+        lock.lock();
+        changed.wait(lock, [&] { return n_synced >= target; });
+        RethrowError();
+        return csv_offset;
+    }
+
+    void OutputWriter::Close()
+    {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            if (closed) return;
+            closing = true;
+            closed = true;
+        }
+        changed.notify_all();
+        thread.join();
+
+        FlushCSV();
+        fout.close();
+        if (tree != nullptr)
+        {
+            file->cd();
+            tree->Write("", TObject::kOverwrite);
+            tree = nullptr;
+        }
+        file->Close();
+        {
+            lock_guard<std::mutex> lock(mutex);
+            RethrowError();
+        }
+        if (fout.fail())
+            throw runtime_error("There was a problem writing the CSV output.");
+    }
+
+    void OutputWriter::Push(Task task)
+    {
+        unique_lock<std::mutex> lock(mutex);
+        if (closing)
+            throw runtime_error("The output writer has already been closed.");
+        RethrowError();
+        changed.wait(lock, [&] { return queue.size() < max_queue; });
+        queue.push_back(move(task));
+        lock.unlock();
+        changed.notify_all();
+    }
+
+    void OutputWriter::Loop()
+    {
+        file->cd();
+        while (true)
+        {
+            unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return closing || !queue.empty(); });
+            if (queue.empty()) return;
+            Task task = move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            changed.notify_all();
+            try
+            {
+                Perform(task);
+            }
+            catch (...)
+            {
+                lock.lock();
+                if (!error) error = current_exception();
+                lock.unlock();
+            }
+
+            // A sync is always reported, even if it failed, so that the caller doesn't wait forever.
+            if (task.kind == Task::Kind::sync)
+            {
+                lock.lock();
+                n_synced++;
+                lock.unlock();
+                changed.notify_all();
+            }
+        }
+    }
+
+    void OutputWriter::RethrowError()
+    {
+        if (!error) return;
+        exception_ptr thrown = error;
+        error = nullptr;
+        rethrow_exception(thrown);
+    }
+
+    void OutputWriter::Perform(Task& task)
+    {
+        switch (task.kind)
+        {
+            case Task::Kind::line:
+                csv_buffer += task.line;
+                csv_buffer += '\n';
+                if (csv_buffer.size() >= batch_size) FlushCSV();
+                break;
+
+            case Task::Kind::result:
+                tree_row = task.row;
+                tree->Fill();
+                break;
+
+            case Task::Kind::plots:
+                for (auto& plot : task.plots)
+                    plot.second->Write(plot.first.c_str());
+                break;
+
+            case Task::Kind::prune:
+            {
+                vector<string> stale = vector<string>();
+                TIter next(file->GetListOfKeys());
+                while (TObject* key = next())
+                {
+                    string name = key->GetName();
+                    try
+                    {
+                        if (stoi(name.substr(0, name.find('_'))) >= task.first_id) stale.push_back(name);
+                    }
+                    catch (logic_error&)
+                    {
+                        continue;
+                    }
+                }
+                for (const string& name : stale)
+                    file->Delete((name + ";*").c_str());
+                if (tree != nullptr) PruneTree(task.first_id);
+                break;
+            }
+
+            case Task::Kind::sync:
+            {
+                FlushCSV();
+                fout.flush();
+                if (tree != nullptr) tree->AutoSave("SaveSelf");
+                file->SaveSelf();
+                file->Flush();
+                lock_guard<std::mutex> lock(mutex);
+                csv_offset = (long) fout.tellp();
+                break;
+            }
+        }
+    }
+
+    void OutputWriter::AttachBranches(bool create)
+    {
+        if (create)
+        {
+            tree->Branch("seed", &tree_row.seed, "seed/i");
+            tree->Branch("id", &tree_row.id, "id/I");
+            tree->Branch("energy", &tree_row.energy, "energy/D");
+            tree->Branch("psi", &tree_row.psi, "psi/D");
+            tree->Branch("im", &tree_row.im, "im/D");
+            tree->Branch("gnd", &tree_row.gnd, "gnd/D");
+            tree->Branch("trig", &tree_row.trig, "trig/I");
+            tree->Branch("mono_psi", &tree_row.mono_psi, "mono_psi/D");
+            tree->Branch("mono_im", &tree_row.mono_im, "mono_im/D");
+            tree->Branch("mono_gnd", &tree_row.mono_gnd, "mono_gnd/D");
+            tree->Branch("chkv", &tree_row.chkv, "chkv/I");
+            tree->Branch("chkv_psi", &tree_row.chkv_psi, "chkv_psi/D");
+            tree->Branch("chkv_im", &tree_row.chkv_im, "chkv_im/D");
+            tree->Branch("chkv_gnd", &tree_row.chkv_gnd, "chkv_gnd/D");
+            tree->Branch("weight", &tree_row.weight, "weight/D");
+            tree->Branch("realization", &tree_row.realization, "realization/I");
+            tree->Branch("time", &tree_row.time, "time/D");
+            return;
+        }
+        tree->SetBranchAddress("seed", &tree_row.seed);
+        tree->SetBranchAddress("id", &tree_row.id);
+        tree->SetBranchAddress("energy", &tree_row.energy);
+        tree->SetBranchAddress("psi", &tree_row.psi);
+        tree->SetBranchAddress("im", &tree_row.im);
+        tree->SetBranchAddress("gnd", &tree_row.gnd);
+        tree->SetBranchAddress("trig", &tree_row.trig);
+        tree->SetBranchAddress("mono_psi", &tree_row.mono_psi);
+        tree->SetBranchAddress("mono_im", &tree_row.mono_im);
+        tree->SetBranchAddress("mono_gnd", &tree_row.mono_gnd);
+        tree->SetBranchAddress("chkv", &tree_row.chkv);
+        tree->SetBranchAddress("chkv_psi", &tree_row.chkv_psi);
+        tree->SetBranchAddress("chkv_im", &tree_row.chkv_im);
+        tree->SetBranchAddress("chkv_gnd", &tree_row.chkv_gnd);
+        tree->SetBranchAddress("weight", &tree_row.weight);
+        tree->SetBranchAddress("realization", &tree_row.realization);
+        tree->SetBranchAddress("time", &tree_row.time);
+    }
+
+    void OutputWriter::PruneTree(int first_id)
+    {
+        // The clone shares the branch addresses of the original, so entries can be copied through the row buffer. The
+        // old key is replaced the next time the tree is saved, since trees are always written with kOverwrite.
+        TTree* pruned = tree->CloneTree(0);
+        for (long long i = 0; i < tree->GetEntries(); i++)
+        {
+            tree->GetEntry(i);
+            if (tree_row.id < first_id) pruned->Fill();
+        }
+        delete tree;
+        tree = pruned;
+    }
+
+    void OutputWriter::FlushCSV()
+    {
+        fout.write(csv_buffer.data(), csv_buffer.size());
+        csv_buffer.clear();
+    }
+}
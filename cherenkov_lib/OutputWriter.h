@@ -0,0 +1,209 @@
+// OutputWriter.h
+//
+// Author: Matthew Dutson
+//
+// Definition of OutputWriter class
+
+#ifndef OUTPUT_WRITER_H
+#define OUTPUT_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <TFile.h>
+#include <TTree.h>
+
+#include "Analysis.h"
+#include "Geometric.h"
+#include "Reconstructor.h"
+
+namespace cherenkov_simulator
+{
+    /*
+     * A single row of the results tree. The columns match those of the CSV file, with angles in degrees and distances
+     * in km, plus the wall time in seconds spent simulating and reconstructing the shower. The weight corrects for
+     * showers being generated from a proposal distribution rather than the physical one. The realization numbers the
+     * noise draws of a shower which is reconstructed more than once.
+     */
+    struct ResultRow
+    {
+        ResultRow();
+
+        ResultRow(unsigned int seed, int id, Shower shower, Reconstructor::Result result, Plane ground_plane,
+                  double time, double weight = 1.0, int realization = 0);
+
+        unsigned int seed;
+        int id;
+        double energy;
+        double psi;
+        double im;
+        double gnd;
+        int trig;
+        double mono_psi;
+        double mono_im;
+        double mono_gnd;
+        int chkv;
+        double chkv_psi;
+        double chkv_im;
+        double chkv_gnd;
+        double weight;
+        int realization;
+        double time;
+    };
+
+    /*
+     * Owns the CSV and ROOT output files of a Monte Carlo run and writes to them from a dedicated thread. Callers hand
+     * over rows and plots through a bounded queue and only block if the queue is full. CSV rows are batched into large
+     * writes instead of being flushed one at a time, and ROOT objects are written with the configured compression.
+     * Since only the writer thread touches the ROOT file, callers never need to lock the current ROOT directory. An
+     * exception thrown while writing is held by the writer and rethrown by the next call which queues, syncs, or
+     * closes. If requested, results are also written as typed columns to a TTree named "results", which can be read
+     * without parsing text. Trees from several runs can be combined with a TChain or hadd.
+     */
+    class OutputWriter
+    {
+    public:
+
+        /*
+         * Opens <output_file>.csv and <output_file>.root and starts the writer thread. If append is true, the CSV file
+         * is appended to and the ROOT file is updated rather than recreated. If results_tree is true, the results tree
+         * is created, or reopened when appending. Throws a runtime_error if either file can't be opened.
+         */
+        OutputWriter(std::string output_file, bool append, int compression, size_t max_queue,
+                     bool results_tree = false);
+
+        /*
+         * Writes everything still in the queue and closes both files.
+         */
+        ~OutputWriter();
+
+        OutputWriter(const OutputWriter&) = delete;
+        OutputWriter& operator=(const OutputWriter&) = delete;
+
+        /*
+         * Queues a line of the CSV file. A newline is added.
+         */
+        void WriteLine(std::string line);
+
+        /*
+         * Queues a row of the results tree. Ignored if the writer has no results tree.
+         */
+        void WriteResult(const ResultRow& row);
+
+        /*
+         * Queues a list of plots for the ROOT file. Ownership of the objects is passed to the writer.
+         */
+        void WritePlots(PlotList plots);
+
+        /*
+         * Queues the removal of all ROOT objects and result rows belonging to showers with an ID at or after first_id.
+         * Shower objects are named "<id>_<description>". Used when resuming a run.
+         */
+        void RemoveShowersAfter(int first_id);
+
+        /*
+         * Blocks until everything queued so far has been written and both files are flushed to disk, then returns the
+         * size of the CSV file.
+         */
+        long Sync();
+
+        /*
+         * Writes everything still in the queue, stops the writer thread, and closes both files. Throws a runtime_error
+         * if any write to the CSV file failed, or rethrows an exception from the writer thread.
+         */
+        void Close();
+
+    private:
+
+        /*
+         * A single unit of work for the writer thread.
+         */
+        struct Task
+        {
+            enum class Kind
+            {
+                line,
+                result,
+                plots,
+                prune,
+                sync
+            };
+
+            Kind kind;
+            std::string line;
+            ResultRow row;
+            PlotList plots;
+            int first_id;
+        };
+
+        // The size of the CSV buffer which triggers a write.
+        static const size_t batch_size = 1 << 16;
+
+        std::ofstream fout;
+        std::unique_ptr<TFile> file;
+        std::string csv_buffer;
+
+        // The results tree belongs to the file. The row holds the branch buffers.
+        TTree* tree;
+        ResultRow tree_row;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<Task> queue;
+        size_t max_queue;
+        bool closing;
+        bool closed;
+
+        // The first exception thrown on the writer thread which hasn't been rethrown yet.
+        std::exception_ptr error;
+
+        // Used to hand the results of a Sync() back to the caller.
+        long n_synced;
+        long csv_offset;
+
+        /*
+         * Adds a task to the queue, waiting if the queue is full.
+         */
+        void Push(Task task);
+
+        /*
+         * Rethrows the exception held from the writer thread, if there is one, and clears it. The mutex must be
+         * locked.
+         */
+        void RethrowError();
+
+        /*
+         * The body of the writer thread. Runs tasks until Close() is called and the queue is empty. Exceptions thrown
+         * by a task are held rather than ending the thread.
+         */
+        void Loop();
+
+        /*
+         * Performs a single task on the writer thread.
+         */
+        void Perform(Task& task);
+
+        /*
+         * Points the branches of the results tree at the row buffer, creating them if the tree is new.
+         */
+        void AttachBranches(bool create);
+
+        /*
+         * Replaces the results tree with a copy containing only rows with an ID before first_id.
+         */
+        void PruneTree(int first_id);
+
+        /*
+         * Writes the contents of the CSV buffer to the file.
+         */
+        void FlushCSV();
+    };
+}
+
+#endif
@@ -0,0 +1,186 @@
+// PhotonCodec.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of PhotonCodec.h
+
+#include <stdexcept>
+
+#include "PhotonCodec.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    /*
+     * Maps signed values to unsigned ones so that small magnitudes of either sign produce short varints.
+     */
+    static uint64_t ZigZag(int value)
+    {
+        return value < 0 ? 2 * (uint64_t) (-(int64_t) value) - 1 : 2 * (uint64_t) value;
+    }
+
+    static int UnZigZag(uint64_t value)
+    {
+        return (value & 1) ? -(int) ((value + 1) / 2) : (int) (value / 2);
+    }
+
+    void PhotonCodec::Encode(const PhotonCount& data, bool delta, string& buffer)
+    {
+        size_t n_bins = data.counts.empty() ? 0 : data.counts[0][0].size();
+        string body = string();
+        size_t n_filled = 0;
+        size_t last_pixel = 0;
+        for (size_t i = 0; i < data.Size(); i++)
+        {
+            for (size_t j = 0; j < data.Size(); j++)
+            {
+                const Short1D& signal = data.counts[i][j];
+                size_t first = 0;
+                while (first < n_bins && signal[first] == 0) first++;
+                if (first == n_bins) continue;
+                size_t last = n_bins - 1;
+                while (signal[last] == 0) last--;
+
+                size_t pixel = i * data.Size() + j;
+                PutVarint(pixel - last_pixel, body);
+                PutVarint(first, body);
+                PutVarint(last - first + 1, body);
+                last_pixel = pixel;
+                n_filled++;
+
+                int previous = 0;
+                size_t t = first;
+                while (t <= last)
+                {
+                    int value = delta ? signal[t] - previous : signal[t];
+                    previous = signal[t];
+                    PutVarint(ZigZag(value), body);
+                    t++;
+                    if (value != 0) continue;
+
+                    // A zero is followed by the length of the run of zeros after it.
+                    size_t run = 0;
+                    while (t <= last && (delta ? signal[t] - previous : signal[t]) == 0)
+                    {
+                        previous = signal[t];
+                        run++;
+                        t++;
+                    }
+                    PutVarint(run, body);
+                }
+            }
+        }
+
+        PutVarint(data.Size(), buffer);
+        PutVarint(n_bins, buffer);
+        PutVarint(delta ? 1 : 0, buffer);
+        PutVarint(n_filled, buffer);
+        buffer += body;
+    }
+
+    void PhotonCodec::Decode(const string& buffer, PhotonCount& data)
+    {
+        SignalDecoder decoder = SignalDecoder(buffer.data(), buffer.data() + buffer.size());
+        size_t n_bins = data.counts.empty() ? 0 : data.counts[0][0].size();
+        if (decoder.Size() != data.Size() || decoder.NBins() != n_bins)
+            throw runtime_error("Encoded signal doesn't match the size of the PhotonCount");
+
+        size_t pixel, first_bin;
+        Short1D span;
+        while (decoder.Next(pixel, first_bin, span))
+        {
+            size_t i = pixel / data.Size();
+            size_t j = pixel % data.Size();
+            Short1D& signal = data.counts[i][j];
+            fill(signal.begin(), signal.end(), 0);
+            copy(span.begin(), span.end(), signal.begin() + first_bin);
+
+            int sum = 0;
+            for (short count : span) sum += count;
+            data.sums[i][j] = (short) sum;
+            if (sum > 0) data.empty = false;
+        }
+    }
+
+    void PhotonCodec::PutVarint(uint64_t value, string& buffer)
+    {
+        while (value >= 0x80)
+        {
+            buffer.push_back((char) ((value & 0x7F) | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back((char) value);
+    }
+
+    SignalDecoder::SignalDecoder(const char* begin, const char* end)
+    {
+        this->curr = (const uint8_t*) begin;
+        this->end = (const uint8_t*) end;
+        n_pixels = GetVarint();
+        n_bins = GetVarint();
+        delta = GetVarint() != 0;
+        n_filled = GetVarint();
+        n_read = 0;
+        last_pixel = 0;
+    }
+
+    size_t SignalDecoder::Size() const
+    {
+        return n_pixels;
+    }
+
+    size_t SignalDecoder::NBins() const
+    {
+        return n_bins;
+    }
+
+    size_t SignalDecoder::NFilled() const
+    {
+        return n_filled;
+    }
+
+    bool SignalDecoder::Next(size_t& pixel, size_t& first_bin, Short1D& span)
+    {
+        if (n_read == n_filled) return false;
+        pixel = last_pixel + GetVarint();
+        first_bin = GetVarint();
+        size_t length = GetVarint();
+        if (pixel >= n_pixels * n_pixels || first_bin + length > n_bins)
+            throw runtime_error("Encoded signal is malformed");
+        last_pixel = pixel;
+        n_read++;
+
+        span.resize(length);
+        int previous = 0;
+        size_t t = 0;
+        while (t < length)
+        {
+            int value = UnZigZag(GetVarint());
+            previous = delta ? previous + value : value;
+            span[t++] = (short) previous;
+            if (value != 0) continue;
+
+            size_t run = GetVarint();
+            if (t + run > length)
+                throw runtime_error("Encoded signal is malformed");
+            for (size_t k = 0; k < run; k++)
+                span[t++] = (short) previous;
+        }
+        return true;
+    }
+
+    uint64_t SignalDecoder::GetVarint()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            if (curr == end)
+                throw runtime_error("Encoded signal ended unexpectedly");
+            uint8_t byte = *curr++;
+            value |= (uint64_t) (byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return value;
+        }
+        throw runtime_error("Encoded signal is malformed");
+    }
+}
@@ -0,0 +1,100 @@
+// PhotonCodec.h
+//
+// Author: Matthew Dutson
+//
+// Defines PhotonCodec and SignalDecoder classes
+
+#ifndef PHOTON_CODEC_H
+#define PHOTON_CODEC_H
+
+#include <cstdint>
+#include <string>
+
+#include "DataStructures.h"
+
+namespace cherenkov_simulator
+{
+    /*
+     * A zero-suppressed encoding for the signals in a PhotonCount. Only pixels with a nonzero signal are written. Each
+     * is stored as the distance from the previous pixel index, the first nonzero bin, the length of the span up to the
+     * last nonzero bin, and the counts in that span. Counts are zigzag varints, and each zero is followed by the number
+     * of zeros which repeat it. With delta coding, the differences between consecutive bins are stored instead of the
+     * counts themselves, which is smaller for smooth, bright signals.
+     */
+    class PhotonCodec
+    {
+    public:
+
+        /*
+         * Appends the encoding of the signals in the PhotonCount to the buffer.
+         */
+        static void Encode(const PhotonCount& data, bool delta, std::string& buffer);
+
+        /*
+         * Decodes a buffer produced by Encode() into a PhotonCount with the same number of pixels and bins. Signals of
+         * pixels in the buffer are replaced. Throws a runtime_error if the buffer is malformed or the sizes differ.
+         */
+        static void Decode(const std::string& buffer, PhotonCount& data);
+
+    private:
+
+        /*
+         * Appends an unsigned integer in base-128 varint form.
+         */
+        static void PutVarint(uint64_t value, std::string& buffer);
+    };
+
+    /*
+     * Reads a buffer produced by PhotonCodec::Encode() one pixel at a time, without expanding the whole PhotonCount.
+     */
+    class SignalDecoder
+    {
+    public:
+
+        /*
+         * Reads the header at the start of the buffer. The buffer must outlive the decoder. Throws a runtime_error if
+         * the header is malformed.
+         */
+        SignalDecoder(const char* begin, const char* end);
+
+        /*
+         * Returns the diameter of the encoded pixel array.
+         */
+        size_t Size() const;
+
+        /*
+         * Returns the number of bins in each encoded time series.
+         */
+        size_t NBins() const;
+
+        /*
+         * Returns the number of pixels with a nonzero signal.
+         */
+        size_t NFilled() const;
+
+        /*
+         * Decodes the next nonzero pixel. Sets the pixel index (x * Size() + y), the first nonzero bin, and the counts
+         * from that bin through the last nonzero bin. Returns false once every pixel has been read. Throws a
+         * runtime_error if the buffer is malformed.
+         */
+        bool Next(size_t& pixel, size_t& first_bin, Short1D& span);
+
+    private:
+
+        const uint8_t* curr;
+        const uint8_t* end;
+        size_t n_pixels;
+        size_t n_bins;
+        size_t n_filled;
+        size_t n_read;
+        size_t last_pixel;
+        bool delta;
+
+        /*
+         * Reads an unsigned base-128 varint.
+         */
+        uint64_t GetVarint();
+    };
+}
+
+#endif
@@ -0,0 +1,134 @@
+// Profiler.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of Profiler.h
+
+#include <sstream>
+
+#include "Profiler.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    PhotonFunnel::PhotonFunnel()
+    {
+        for (auto& source : counts)
+            for (long& count : source)
+                count = 0;
+    }
+
+    void PhotonFunnel::Add(const PhotonFunnel& other)
+    {
+        for (int i = 0; i < n_sources; i++)
+            for (int j = 0; j < n_outcomes; j++)
+                counts[i][j] += other.counts[i][j];
+    }
+
+    long PhotonFunnel::Total(Source source) const
+    {
+        long total = 0;
+        for (long count : counts[source])
+            total += count;
+        return total;
+    }
+
+    string PhotonFunnel::Name(int outcome)
+    {
+        const char* names[] = {"Lens", "Blocked", "Mirror", "Camera", "Range", "Time", "Detected"};
+        return names[outcome];
+    }
+
+    string PhotonFunnel::Summary() const
+    {
+        stringstream stream = stringstream();
+        const char* sources[] = {"Fluorescence", "Cherenkov"};
+        for (int i = 0; i < n_sources; i++)
+        {
+            long total = Total((Source) i);
+            stream << sources[i] << " photons (" << total << " traced):";
+            for (int j = 0; j < n_outcomes; j++)
+                stream << " " << Name(j) << " " << (total > 0 ? 100.0 * counts[i][j] / total : 0) << "%";
+            if (i + 1 < n_sources) stream << endl;
+        }
+        return stream.str();
+    }
+
+    ShowerProfile::ShowerProfile()
+    {
+        for (double& time : seconds)
+            time = 0;
+        flor_photons = 0;
+        chkv_photons = 0;
+        current = -1;
+    }
+
+    void ShowerProfile::Switch(int stage)
+    {
+        Clock::time_point now = Clock::now();
+        if (current >= 0) seconds[current] += chrono::duration<double>(now - mark).count();
+        mark = now;
+        current = stage;
+    }
+
+    int ShowerProfile::Current() const
+    {
+        return current;
+    }
+
+    void ShowerProfile::Add(const ShowerProfile& other)
+    {
+        for (int i = 0; i < n_stages; i++)
+            seconds[i] += other.seconds[i];
+        flor_photons += other.flor_photons;
+        chkv_photons += other.chkv_photons;
+        funnel.Add(other.funnel);
+    }
+
+    string ShowerProfile::Header()
+    {
+        return "FlorTime(s),ChkvTime(s),OpticsTime(s),NoiseTime(s),ClearTime(s),ReconTime(s),FlorPhotons,ChkvPhotons";
+    }
+
+    string ShowerProfile::ToString() const
+    {
+        stringstream stream = stringstream();
+        for (double time : seconds)
+            stream << time << ",";
+        stream << flor_photons << "," << chkv_photons;
+        return stream.str();
+    }
+
+    string ShowerProfile::Summary() const
+    {
+        const char* names[] = {"Fluorescence", "Cherenkov", "Optics", "Noise", "Clear", "Reconstruct"};
+        double total = 0;
+        for (double time : seconds)
+            total += time;
+
+        stringstream stream = stringstream();
+        stream << "Time by stage (s):" << endl;
+        for (int i = 0; i < n_stages; i++)
+            stream << "  " << names[i] << ": " << seconds[i] << " (" << (total > 0 ? 100 * seconds[i] / total : 0)
+                   << "%)" << endl;
+        stream << "Photons traced: " << flor_photons << " fluorescence, " << chkv_photons << " Cherenkov";
+        if (flor_photons + chkv_photons > 0)
+            stream << " (" << 1e9 * seconds[optics] / (flor_photons + chkv_photons) << " ns/photon in optics)";
+        return stream.str();
+    }
+
+    StageTimer::StageTimer(ShowerProfile* profile, ShowerProfile::Stage stage)
+    {
+        this->profile = profile;
+        previous = -1;
+        if (profile == nullptr) return;
+        previous = profile->Current();
+        profile->Switch(stage);
+    }
+
+    StageTimer::~StageTimer()
+    {
+        if (profile != nullptr) profile->Switch(previous);
+    }
+}
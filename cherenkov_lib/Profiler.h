@@ -0,0 +1,188 @@
+// Profiler.h
+//
+// Author: Matthew Dutson
+//
+// Definitions of ShowerProfile and StageTimer, which record where the time is spent on each shower. Profiling is only
+// compiled in when CHERENKOV_PROFILE is defined (see the CHERENKOV_PROFILE option in CMakeLists.txt). Otherwise, the
+// PROFILE_STAGE and PROFILE_COUNT macros do nothing and profiles stay empty.
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <string>
+
+#ifdef CHERENKOV_PROFILE
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_STAGE(profile, stage) \
+    StageTimer PROFILE_CONCAT(stage_timer_, __LINE__)(profile, ShowerProfile::stage)
+#define PROFILE_COUNT(profile, counter, n) \
+    do { if ((profile) != nullptr) (profile)->counter += (n); } while (0)
+#else
+#define PROFILE_STAGE(profile, stage)
+#define PROFILE_COUNT(profile, counter, n) do { } while (0)
+#endif
+
+namespace cherenkov_simulator
+{
+    /*
+     * Counts what happens to each photon traced through the detector, separately for fluorescence and Cherenkov
+     * photons. A photon is either detected or lost at one of the steps of Simulator::SimulateOptics() and
+     * PhotonCount::AddPhoton().
+     */
+    struct PhotonFunnel
+    {
+        /*
+         * The fate of a traced photon, in the order the checks are made.
+         */
+        enum Outcome
+        {
+            lens,
+            blocked,
+            mirror,
+            camera,
+            out_of_range,
+            out_of_time,
+            detected,
+            n_outcomes
+        };
+
+        /*
+         * The process which produced a photon.
+         */
+        enum Source
+        {
+            fluorescence,
+            cherenkov,
+            n_sources
+        };
+
+        long counts[n_sources][n_outcomes];
+
+        /*
+         * Creates a funnel with no photons counted.
+         */
+        PhotonFunnel();
+
+        /*
+         * Adds the counts of another funnel to this one.
+         */
+        void Add(const PhotonFunnel& other);
+
+        /*
+         * Returns the total number of photons traced from the specified source.
+         */
+        long Total(Source source) const;
+
+        /*
+         * Returns a short description of an outcome.
+         */
+        static std::string Name(int outcome);
+
+        /*
+         * Returns a human-readable summary of the fraction of photons with each outcome.
+         */
+        std::string Summary() const;
+    };
+
+    /*
+     * The time spent in each stage of simulating and reconstructing a shower, along with the number of photons traced.
+     * Stage times are exclusive, so time spent tracing photons through the optics isn't counted as time spent
+     * generating them. The photon funnel is counted even if profiling isn't compiled in, since it only costs an
+     * increment per photon.
+     */
+    struct ShowerProfile
+    {
+        /*
+         * The stages which are timed. Used as indices into the array of times.
+         */
+        enum Stage
+        {
+            fluorescence,
+            cherenkov,
+            optics,
+            noise,
+            clear,
+            reconstruct,
+            n_stages
+        };
+
+#ifdef CHERENKOV_PROFILE
+        static const bool enabled = true;
+#else
+        static const bool enabled = false;
+#endif
+
+        double seconds[n_stages];
+        long flor_photons;
+        long chkv_photons;
+        PhotonFunnel funnel;
+
+        /*
+         * Creates a profile with no recorded time.
+         */
+        ShowerProfile();
+
+        /*
+         * Charges the time since the last switch to the current stage and makes the specified stage current. Pass -1
+         * to stop timing.
+         */
+        void Switch(int stage);
+
+        /*
+         * Returns the current stage, or -1 if nothing is being timed.
+         */
+        int Current() const;
+
+        /*
+         * Adds the times, counts, and funnel of another profile to this one.
+         */
+        void Add(const ShowerProfile& other);
+
+        /*
+         * Returns a CSV header matching ToString().
+         */
+        static std::string Header();
+
+        /*
+         * Returns the stage times (in seconds) and photon counts as CSV columns.
+         */
+        std::string ToString() const;
+
+        /*
+         * Returns a human-readable summary of the total time spent in each stage and its share of the total.
+         */
+        std::string Summary() const;
+
+    private:
+
+        typedef std::chrono::steady_clock Clock;
+
+        int current;
+        Clock::time_point mark;
+    };
+
+    /*
+     * Times a stage for as long as the timer is in scope. Whatever stage was current when the timer was created is
+     * paused, and resumes when the timer is destroyed. Does nothing if the profile is null.
+     */
+    class StageTimer
+    {
+    public:
+
+        StageTimer(ShowerProfile* profile, ShowerProfile::Stage stage);
+
+        ~StageTimer();
+
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+
+    private:
+
+        ShowerProfile* profile;
+        int previous;
+    };
+}
+
+#endif
@@ -4,13 +4,19 @@
 //
 // Implementation of Reconstructor.h
 
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <Math/MinimizerOptions.h>
 #include <TF1.h>
 #include <TFile.h>
 #include <TGraphErrors.h>
 #include <TMath.h>
 #include <TMatrixDSymEigen.h>
 
+#include "BufferPool.h"
 #include "Reconstructor.h"
+#include "Simulator.h"
 
 using namespace std;
 using namespace boost::property_tree;
@@ -49,14 +55,25 @@ namespace cherenkov_simulator
 
         double mirror_radius = config.get<double>("detector.mirror_radius");
         double stop_diameter = mirror_radius / (2.0 * config.get<double>("detector.f_number"));
-        sky_noise = Sq(stop_diameter / 2.0) * Pi() * glob_sky_noise;
-        gnd_noise = Sq(stop_diameter / 2.0) * Pi() * glob_gnd_noise;
+        double stop_area = Sq(stop_diameter / 2.0) * Pi();
+        sky_noise = stop_area * glob_sky_noise;
+        gnd_noise = stop_area * glob_gnd_noise;
+        string mode = config.get<string>("simulation.noise_mode");
+        if (mode == "dense") noise_mode = NoiseMode::dense;
+        else if (mode == "sparse") noise_mode = NoiseMode::sparse;
+        else if (mode == "tail") noise_mode = NoiseMode::tail;
+        else throw runtime_error("The noise mode must be dense, sparse, or tail.");
 
         trigr_thresh = config.get<double>("triggering.trigr_thresh");
         noise_thresh = config.get<double>("triggering.noise_thresh");
         impact_buffr = config.get<double>("triggering.impact_buffr");
         plane_thresh = config.get<double>("triggering.plane_thresh");
         trigr_clustr = config.get<int>("triggering.trigr_clustr");
+
+        PhotonCount::Params params = Simulator::MakeCountParams(config);
+        string map_file = config.get<string>("surroundings.noise_map");
+        Double2D noise_map = map_file.empty() ? Double2D() : ReadNoiseMap(map_file, params.n_pixels);
+        MakeNoiseTables(params, stop_area, noise_map);
     }
 
     Reconstructor::Result Reconstructor::Reconstruct(const PhotonCount& data) const
@@ -83,12 +100,81 @@ namespace cherenkov_simulator
 
     void Reconstructor::AddNoise(PhotonCount& data) const
     {
+        CheckTables(data);
         PhotonCount::Iterator iter = data.GetIterator();
         while (iter.Next())
         {
-            bool toward_ground = ground_plane.InFrontOf(rot_to_world * data.Direction(iter));
-            data.AddNoise(toward_ground ? gnd_noise : sky_noise, iter);
+            int x = iter.X();
+            int y = iter.Y();
+            double noise_rate = pixel_noise[x][y];
+            if (noise_mode == NoiseMode::tail)
+                data.AddTailNoise(noise_rate, Min(noise_table[x][y], trigr_table[x][y]), iter);
+            else if (noise_mode == NoiseMode::sparse) data.AddSparseNoise(noise_rate, iter);
+            else data.AddNoise(noise_rate, iter);
+        }
+    }
+
+    void Reconstructor::MakeNoiseTables(PhotonCount::Params params, double stop_area, const Double2D& noise_map)
+    {
+        // A PhotonCount with a single time bin gives the pixel directions and the conversion to counts per bin.
+        PhotonCount geometry = PhotonCount(params, 0.0, params.bin_size);
+        table_params = params;
+        size_t n_pixels = geometry.Size();
+        valid_pixels = geometry.GetValid();
+        toward_ground = Bool2D(n_pixels, Bool1D(n_pixels, false));
+        pixel_noise = Double2D(n_pixels, Double1D(n_pixels, 0.0));
+        noise_table = Int2D(n_pixels, vector<int>(n_pixels, 0));
+        trigr_table = Int2D(n_pixels, vector<int>(n_pixels, 0));
+
+        PhotonCount::Iterator iter = geometry.GetIterator();
+        while (iter.Next())
+        {
+            int x = iter.X();
+            int y = iter.Y();
+            toward_ground[x][y] = ground_plane.InFrontOf(rot_to_world * geometry.Direction(iter));
+            if (noise_map.empty()) pixel_noise[x][y] = toward_ground[x][y] ? gnd_noise : sky_noise;
+            else pixel_noise[x][y] = stop_area * noise_map[x][y];
+            noise_table[x][y] = geometry.FindThreshold(pixel_noise[x][y], noise_thresh);
+            trigr_table[x][y] = geometry.FindThreshold(pixel_noise[x][y], trigr_thresh);
+        }
+    }
+
+    Double2D Reconstructor::ReadNoiseMap(string map_file, size_t n_pixels)
+    {
+        ifstream fin = ifstream(map_file);
+        if (fin.fail())
+            throw runtime_error("The file " + map_file + " could not be opened. Check the path.");
+
+        Double1D values = Double1D();
+        string line;
+        while (getline(fin, line))
+        {
+            if (line.empty() || line[0] == '#') continue;
+            stringstream line_stream = stringstream(line);
+            double value;
+            while (line_stream >> value)
+            {
+                if (value < 0) throw runtime_error("The noise map " + map_file + " contains a negative rate.");
+                values.push_back(value);
+            }
+            if (!line_stream.eof()) throw runtime_error("The noise map " + map_file + " contains a non-number.");
         }
+        if (values.size() != n_pixels * n_pixels)
+            throw runtime_error("The noise map " + map_file + " must contain " + to_string(n_pixels) + " rows of "
+                                + to_string(n_pixels) + " rates.");
+
+        Double2D noise_map = Double2D(n_pixels, Double1D(n_pixels));
+        for (size_t i = 0; i < values.size(); i++)
+            noise_map[i / n_pixels][i % n_pixels] = values[i];
+        return noise_map;
+    }
+
+    void Reconstructor::CheckTables(const PhotonCount& data) const
+    {
+        // The thresholds are in counts per bin, so they only hold for the bin and pixel sizes they were found with.
+        if (data.Size() != pixel_noise.size() || data.BinSize() != table_params.bin_size ||
+            data.AngSize() != table_params.ang_size)
+            throw invalid_argument("The PhotonCount doesn't have the pixel array and time bins of the configuration.");
     }
 
     Shower Reconstructor::MonocularFit(const PhotonCount& data, TRotation to_sdp, string graph_file) const
@@ -101,7 +187,7 @@ namespace cherenkov_simulator
         func.SetParNames("t_0", "r_p", "psi");
         func.SetParameters(0.0, 1e6, PiOver2());
         TGraphErrors data_graph = GetFitGraph(data, to_sdp);
-        data_graph.Fit("profile_fit", "Q");
+        FitGraph(data_graph, func);
         TF1* result = data_graph.GetFunction("profile_fit");
         if (!graph_file.empty())
         {
@@ -129,7 +215,7 @@ namespace cherenkov_simulator
         func.SetParNames("t_0", "psi");
         func.SetParameters(0.0, PiOver2());
         TGraphErrors data_graph = GetFitGraph(data, to_sdp);
-        data_graph.Fit("profile_fit", "Q");
+        FitGraph(data_graph, func);
         TF1* result = data_graph.GetFunction("profile_fit");
         if (!graph_file.empty())
         {
@@ -143,6 +229,16 @@ namespace cherenkov_simulator
         return MakeShower(t_0, r_p, psi, to_sdp);
     }
 
+    void Reconstructor::FitGraph(TGraphErrors& graph, TF1& func)
+    {
+        // TMinuit keeps its state in a single global instance, so fits with it can't run on several threads at once.
+        // Minuit2 keeps its state in each fit, and is selected as the default wherever showers are fit in parallel.
+        static mutex minuit_mutex;
+        unique_lock<mutex> lock(minuit_mutex, defer_lock);
+        if (ROOT::Math::MinimizerOptions::DefaultMinimizerType() != "Minuit2") lock.lock();
+        graph.Fit(&func, "Q");
+    }
+
     TRotation Reconstructor::FitSDPlane(const PhotonCount& data, const Bool3D* mask) const
     {
         PhotonCount::Iterator iter = data.GetIterator();
@@ -197,17 +293,19 @@ namespace cherenkov_simulator
 
     bool Reconstructor::FindGroundImpact(const PhotonCount& data, TVector3& impact) const
     {
+        CheckTables(data);
         TVector3 reflect_dir = TVector3();
         int highest_sum = 0;
+        int reflect_thresh = 0;
         PhotonCount::Iterator iter = data.GetIterator();
         while (iter.Next())
         {
-            TVector3 direction = rot_to_world * data.Direction(iter);
             int sum = data.SumBins(iter);
-            if (sum > highest_sum && ground_plane.InFrontOf(direction))
+            if (sum > highest_sum && toward_ground[iter.X()][iter.Y()])
             {
                 highest_sum = sum;
-                reflect_dir = direction;
+                reflect_dir = rot_to_world * data.Direction(iter);
+                reflect_thresh = trigr_table[iter.X()][iter.Y()];
             }
         }
 
@@ -215,7 +313,7 @@ namespace cherenkov_simulator
         Ray outward_ray = Ray(TVector3(), reflect_dir, 0);
         outward_ray.PropagateToPlane(ground_plane);
         impact = outward_ray.Position();
-        return highest_sum > data.FindThreshold(gnd_noise, trigr_thresh);
+        return highest_sum > reflect_thresh;
     }
 
     TGraphErrors Reconstructor::GetFitGraph(const PhotonCount& data, TRotation to_sdp) const
@@ -245,17 +343,15 @@ namespace cherenkov_simulator
 
     void Reconstructor::SubtractAverageNoise(PhotonCount& data) const
     {
+        CheckTables(data);
         PhotonCount::Iterator iter = data.GetIterator();
         while (iter.Next())
-        {
-            bool toward_ground = ground_plane.InFrontOf(rot_to_world * data.Direction(iter));
-            data.Subtract(toward_ground ? gnd_noise : sky_noise, iter);
-        }
+            data.Subtract(pixel_noise[iter.X()][iter.Y()], iter);
     }
 
     Bool1D Reconstructor::GetTriggeringState(const PhotonCount& data) const
     {
-        Bool3D trig_matrices = GetThresholdMatrices(data, trigr_thresh, false);
+        Bool3D trig_matrices = GetThresholdMatrices(data, trigr_table, false);
         Bool1D good_frames = Bool1D(data.NBins(), false);
 
         list<array<size_t, 3>> frontier = list<array<size_t, 3>>();
@@ -289,14 +385,16 @@ namespace cherenkov_simulator
             }
             good_frames[t_trig] = found;
         }
+        BufferPool::GiveMask(move(trig_matrices));
         return good_frames;
     }
 
     void Reconstructor::ClearNoise(PhotonCount& data) const
     {
-        SubtractAverageNoise(data);
-        Bool3D not_visited = GetThresholdMatrices(data, noise_thresh);
-        Bool3D triggered = GetThresholdMatrices(data, trigr_thresh);
+        // Tail noise is added with the average already subtracted.
+        if (noise_mode != NoiseMode::tail) SubtractAverageNoise(data);
+        Bool3D not_visited = GetThresholdMatrices(data, noise_table);
+        Bool3D triggered = GetThresholdMatrices(data, trigr_table);
         Bool3D good_pixels = data.GetFalseMatrix();
         FindPlaneSubset(data, triggered);
         Bool1D trig_state = GetTriggeringState(data);
@@ -326,6 +424,24 @@ namespace cherenkov_simulator
             }
         }
         data.Subset(good_pixels);
+        BufferPool::GiveMask(move(not_visited));
+        BufferPool::GiveMask(move(triggered));
+        BufferPool::GiveMask(move(good_pixels));
+    }
+
+    double Reconstructor::TriggerSignal(PhotonCount::Params params) const
+    {
+        double signal = Infinity();
+        for (size_t x = 0; x < valid_pixels.size(); x++)
+        {
+            for (size_t y = 0; y < valid_pixels[x].size(); y++)
+            {
+                if (!valid_pixels[x][y]) continue;
+                double mean = pixel_noise[x][y] * Sq(params.ang_size) * params.bin_size;
+                signal = Min(signal, trigr_table[x][y] - mean);
+            }
+        }
+        return signal;
     }
 
     void Reconstructor::VisitSpaceAdj(size_t x, size_t y, size_t t, list<array<size_t, 3>>& front, Bool3D& not_visited)
@@ -366,7 +482,7 @@ namespace cherenkov_simulator
         while (iter.Next())
         {
             if (!NearPlane(to_sd_plane, rot_to_world * data.Direction(iter)))
-                triggered[iter.X()][iter.Y()] = Bool1D(data.NBins(), false);
+                triggered[iter.X()][iter.Y()].assign(data.NBins(), false);
         }
     }
 
@@ -384,17 +500,16 @@ namespace cherenkov_simulator
         return false;
     }
 
-    Bool3D Reconstructor::GetThresholdMatrices(const PhotonCount& data, double sigma_mult, bool use_below_horiz) const
+    Bool3D Reconstructor::GetThresholdMatrices(const PhotonCount& data, const Int2D& thresholds,
+                                               bool use_below_horiz) const
     {
-        int gnd_thresh = data.FindThreshold(gnd_noise, sigma_mult);
-        int sky_thresh = data.FindThreshold(sky_noise, sigma_mult);
+        CheckTables(data);
         Bool3D pass = data.GetFalseMatrix();
         PhotonCount::Iterator iter = data.GetIterator();
         while (iter.Next())
         {
-            bool toward_ground = ground_plane.InFrontOf(rot_to_world * data.Direction(iter));
-            if (toward_ground && !use_below_horiz) continue;
-            pass[iter.X()][iter.Y()] = data.AboveThreshold(iter, toward_ground ? gnd_thresh : sky_thresh);
+            if (toward_ground[iter.X()][iter.Y()] && !use_below_horiz) continue;
+            data.AboveThreshold(iter, thresholds[iter.X()][iter.Y()], pass[iter.X()][iter.Y()]);
         }
         return pass;
     }
@@ -28,6 +28,20 @@ namespace cherenkov_simulator
     {
     public:
 
+        /*
+         * How background noise is drawn. Dense noise visits every time bin of every pixel, and sparse noise only visits
+         * the bins which receive noise. Both give the same distribution of noise. Tail noise only draws the noise which
+         * can survive ClearNoise(): bins with signal and bins whose noise alone crosses the noise threshold. The
+         * average noise is already subtracted, so the result of ClearNoise() has the same distribution as in the other
+         * modes, but the noise added before clearing does not.
+         */
+        enum class NoiseMode
+        {
+            dense,
+            sparse,
+            tail
+        };
+
         /*
          * A convenience wrapper which summarizes the results of the reconstruction.
          */
@@ -55,7 +69,9 @@ namespace cherenkov_simulator
         };
 
         /*
-         * Constructs the Reconstructor from values in the configuration tree.
+         * Constructs the Reconstructor from values in the configuration tree. The background rate and the noise and
+         * trigger thresholds of every pixel are computed here, so the Reconstructor should only be given PhotonCounts
+         * with the pixel and time bin sizes of the same configuration.
          */
         explicit Reconstructor(const boost::property_tree::ptree& config);
 
@@ -67,7 +83,8 @@ namespace cherenkov_simulator
         Result Reconstruct(const PhotonCount& data) const;
 
         /*
-         * Adds Poisson-distributed background noise to the signal.
+         * Adds Poisson-distributed background noise to the signal, using the configured noise mode. In tail mode, the
+         * result is only meant to be passed to ClearNoise().
          */
         void AddNoise(PhotonCount& data) const;
 
@@ -77,8 +94,16 @@ namespace cherenkov_simulator
          */
         void ClearNoise(PhotonCount& data) const;
 
+        /*
+         * Returns the mean signal, in photons per time bin, which the quietest pixel needs to reach its trigger
+         * threshold. No pixel triggers on a smaller signal.
+         */
+        double TriggerSignal(PhotonCount::Params params) const;
+
     private:
 
+        friend class HotPaths;
+
         // Parameters relating to the position and orientation of the detector relative to its surroundings - cgs
         Plane ground_plane;
         TRotation rot_to_world;
@@ -86,6 +111,15 @@ namespace cherenkov_simulator
         // Detector-specific levels of night sky background noise - cgs, sr
         double sky_noise;
         double gnd_noise;
+        NoiseMode noise_mode;
+
+        // The background rate of each pixel and the thresholds it implies, indexed by [x][y] - cgs, sr
+        PhotonCount::Params table_params;
+        Bool2D valid_pixels;
+        Bool2D toward_ground;
+        Double2D pixel_noise;
+        Int2D noise_table;
+        Int2D trigr_table;
 
         // Parameters used when applying triggering logic and noise reduction
         double trigr_thresh;
@@ -94,6 +128,25 @@ namespace cherenkov_simulator
         double plane_thresh;
         int trigr_clustr;
 
+        /*
+         * Fills the per-pixel tables, scaling the rates of the noise map by the area of the stop. With an empty map,
+         * pixels facing the ground get the ground rate and the rest the sky rate.
+         */
+        void MakeNoiseTables(PhotonCount::Params params, double stop_area, const Double2D& noise_map);
+
+        /*
+         * Reads a map of background rates (1/cm^2 sr s) from a text file with n_pixels rows of n_pixels whitespace
+         * separated values, where rows are x indices and columns are y indices. Lines starting with '#' are skipped.
+         * Throws a runtime_error if the file can't be read or has the wrong number of values.
+         */
+        static Double2D ReadNoiseMap(std::string map_file, size_t n_pixels);
+
+        /*
+         * Throws an invalid_argument if the PhotonCount doesn't have the pixel array or bin size the tables were
+         * computed for.
+         */
+        void CheckTables(const PhotonCount& data) const;
+
         /*
          * Performs an ordinary monocular time profile reconstruction of the shower geometry. A ground impact point is
          * not used.
@@ -129,6 +182,12 @@ namespace cherenkov_simulator
          */
         TGraphErrors GetFitGraph(const PhotonCount& data, TRotation to_sdp) const;
 
+        /*
+         * Fits the function to the graph. Fits are serialized unless the default minimizer is Minuit2, which is the
+         * only one that can be used from several threads at once.
+         */
+        static void FitGraph(TGraphErrors& graph, TF1& func);
+
         /*
          * Subtracts the average amount of noise from each pixel.
          */
@@ -178,10 +237,11 @@ namespace cherenkov_simulator
         bool DetectorTriggered(const Bool1D& trig_state) const;
 
         /*
-         * Returns a 2D array of arrays, each of which contains true values for tubes above the specified multiple of
-         * sigma, and false values for all those below.
+         * Returns a 2D array of arrays, each of which contains true values for tubes above their threshold in the
+         * specified table (noise_table or trigr_table), and false values for all those below.
          */
-        Bool3D GetThresholdMatrices(const PhotonCount& data, double sigma_mult, bool use_below_horiz = true) const;
+        Bool3D GetThresholdMatrices(const PhotonCount& data, const Int2D& thresholds,
+                                    bool use_below_horiz = true) const;
 
         /*
          * Constructs a shower based on the results of the time profile reconstruction.
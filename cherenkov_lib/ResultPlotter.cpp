@@ -0,0 +1,266 @@
+// ResultPlotter.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of ResultPlotter.h
+
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <thread>
+#include <TCanvas.h>
+#include <TROOT.h>
+
+#include "ResultPlotter.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    const vector<ResultPlotter::Params> ResultPlotter::histo_params = {
+        {"mono_im_err", "chkv_im_err", "(mono_im - im) / im", "(chkv_im - im) / im", "impact_err", 80, -1, 1, "", ""},
+        {"mono_psi_err", "chkv_psi_err", "mono_psi - psi", "chkv_psi - psi", "psi_err", 80, -90, 90, "", ""}};
+
+    const vector<ResultPlotter::Params> ResultPlotter::prof_params = {
+        {"mono_im_psi", "chkv_im_psi", "(mono_im - im) / im : psi", "(chkv_im - im) / im : psi", "im_err_psi", 40,
+         0, 180, "Shower Angle (degrees)", "Fractional Impact Error"},
+        {"mono_im_im", "chkv_im_im", "(mono_im - im) / im : im", "(chkv_im - im) / im : im", "im_err_im", 40, 0, 40,
+         "Impact Parameter (km)", "Fractional Impact Error"},
+        {"mono_im_gnd", "chkv_im_gnd", "(mono_im - im) / im : gnd", "(chkv_im - im) / im : gnd", "im_err_gnd", 40, 0,
+         60, "Ground Distance (km)", "Fractional Impact Error"},
+        {"mono_im_en", "chkv_im_en", "(mono_im - im) / im : log(energy) / log(10)",
+         "(chkv_im - im) / im : log(energy) / log(10)", "im_err_en", 40, 17, 21, "Log(Energy)",
+         "Fractional Impact Error"},
+        {"mono_imerr_psierr", "chkv_imerr_psierr", "(mono_im - im) / im : mono_psi - psi",
+         "(chkv_im - im) / im : chkv_psi - psi", "im_err_psi_err", 40, -90, 90, "Angular Error (degrees)",
+         "Fractional Impact Error"}};
+
+    ResultPlotter::ResultPlotter()
+    {
+        // The plots are owned by the plotter, not by whichever directory happens to be current.
+        for (const Params& par : histo_params)
+        {
+            histos.emplace_back(new TH1F(par.mono_name, par.mono_strn, par.n_bins, par.min, par.max));
+            histos.emplace_back(new TH1F(par.chkv_name, par.chkv_strn, par.n_bins, par.min, par.max));
+        }
+        for (const Params& par : prof_params)
+        {
+            profiles.emplace_back(new TProfile(par.mono_name, par.mono_strn, par.n_bins, par.min, par.max));
+            profiles.emplace_back(new TProfile(par.chkv_name, par.chkv_strn, par.n_bins, par.min, par.max));
+        }
+        for (auto& histo : histos)
+            histo->SetDirectory(nullptr);
+        for (auto& profile : profiles)
+            profile->SetDirectory(nullptr);
+    }
+
+    void ResultPlotter::Fill(const ResultRow& row)
+    {
+        if (row.chkv <= 0) return;
+        double mono_im_err = (row.mono_im - row.im) / row.im;
+        double chkv_im_err = (row.chkv_im - row.im) / row.im;
+        double mono_psi_err = row.mono_psi - row.psi;
+        double chkv_psi_err = row.chkv_psi - row.psi;
+        double log_energy = log(row.energy) / log(10);
+
+        histos[0]->Fill(mono_im_err, row.weight);
+        histos[1]->Fill(chkv_im_err, row.weight);
+        histos[2]->Fill(mono_psi_err, row.weight);
+        histos[3]->Fill(chkv_psi_err, row.weight);
+
+        // Profiles follow the order of prof_params: angle, impact, ground distance, energy, and angular error.
+        double mono_x[] = {row.psi, row.im, row.gnd, log_energy, mono_psi_err};
+        double chkv_x[] = {row.psi, row.im, row.gnd, log_energy, chkv_psi_err};
+        for (size_t i = 0; i < prof_params.size(); i++)
+        {
+            profiles[2 * i]->Fill(mono_x[i], mono_im_err, row.weight);
+            profiles[2 * i + 1]->Fill(chkv_x[i], chkv_im_err, row.weight);
+        }
+    }
+
+    void ResultPlotter::FillFile(string filename)
+    {
+        ResultRow row = ResultRow();
+        if (filename.size() > 5 && filename.substr(filename.size() - 5) == ".root")
+        {
+            TFile file(filename.c_str(), "READ");
+            TTree* tree = file.IsZombie() ? nullptr : (TTree*) file.Get("results");
+            if (tree == nullptr)
+                throw runtime_error("The file " + filename + " doesn't contain a results tree.");
+            tree->SetBranchAddress("energy", &row.energy);
+            tree->SetBranchAddress("psi", &row.psi);
+            tree->SetBranchAddress("im", &row.im);
+            tree->SetBranchAddress("gnd", &row.gnd);
+            tree->SetBranchAddress("mono_psi", &row.mono_psi);
+            tree->SetBranchAddress("mono_im", &row.mono_im);
+            tree->SetBranchAddress("chkv", &row.chkv);
+            tree->SetBranchAddress("chkv_psi", &row.chkv_psi);
+            tree->SetBranchAddress("chkv_im", &row.chkv_im);
+            if (tree->GetBranch("weight")) tree->SetBranchAddress("weight", &row.weight);
+            for (long long i = 0; i < tree->GetEntries(); i++)
+            {
+                tree->GetEntry(i);
+                Fill(row);
+            }
+            return;
+        }
+
+        ifstream fin = ifstream(filename);
+        if (fin.fail())
+            throw runtime_error("The file " + filename + " could not be opened. Check the path.");
+        string line;
+        while (getline(fin, line))
+            if (ParseLine(line, row)) Fill(row);
+    }
+
+    void ResultPlotter::Add(const ResultPlotter& other)
+    {
+        for (size_t i = 0; i < histos.size(); i++)
+            histos[i]->Add(other.histos[i].get());
+        for (size_t i = 0; i < profiles.size(); i++)
+            profiles[i]->Add(other.profiles[i].get());
+    }
+
+    void ResultPlotter::Write()
+    {
+        for (size_t i = 0; i < histo_params.size(); i++)
+        {
+            TH1F* mono = histos[2 * i].get();
+            TH1F* chkv = histos[2 * i + 1].get();
+            mono->Write();
+            chkv->Write();
+            TCanvas c_hist(histo_params[i].canv_name, "Histogram Canvas", 432, 500);
+            c_hist.Divide(1, 2);
+            mono->SetTitle("Monocular");
+            chkv->SetTitle("Cherenkov");
+            c_hist.cd(1);
+            mono->Draw();
+            c_hist.cd(2);
+            chkv->Draw();
+            c_hist.Write();
+        }
+
+        for (size_t i = 0; i < prof_params.size(); i++)
+        {
+            const Params& par = prof_params[i];
+            TProfile* mono = profiles[2 * i].get();
+            TProfile* chkv = profiles[2 * i + 1].get();
+            mono->Write();
+            chkv->Write();
+            TCanvas c_prof(par.canv_name, "Profile Canvas", 432, 500);
+            c_prof.Divide(1, 2);
+            mono->SetTitle("Monocular");
+            chkv->SetTitle("Cherenkov");
+            for (TProfile* prof : {mono, chkv})
+            {
+                prof->SetXTitle(par.x_lab);
+                prof->GetXaxis()->CenterTitle(true);
+                prof->GetXaxis()->SetTitleOffset(1.25);
+                prof->SetYTitle(par.y_lab);
+                prof->GetYaxis()->CenterTitle(true);
+                prof->GetYaxis()->SetTitleOffset(1.0);
+                prof->SetMinimum(-1);
+                prof->SetMaximum(1);
+                prof->SetStats(false);
+            }
+            c_prof.cd(1);
+            mono->Draw();
+            c_prof.cd(2);
+            chkv->Draw();
+            c_prof.Write();
+        }
+    }
+
+    bool ResultPlotter::ParseLine(string line, ResultRow& row)
+    {
+        // Columns are seed, id, energy, psi, im, gnd, trig, mono_psi, mono_im, mono_gnd, chkv, chkv_psi, chkv_im,
+        // chkv_gnd, weight, and realization. Any field which isn't a number (as in the header) rejects the line.
+        // Further columns, such as profiling times, are ignored.
+        const int n_required = 14;
+        const int n_columns = 16;
+        double values[n_columns];
+        stringstream stream = stringstream(line);
+        string field;
+        int n_read = 0;
+        while (n_read < n_columns && getline(stream, field, ','))
+        {
+            char* end;
+            values[n_read] = strtod(field.c_str(), &end);
+            if (end == field.c_str()) return false;
+            n_read++;
+        }
+        if (n_read < n_required) return false;
+
+        row.seed = (unsigned int) values[0];
+        row.id = (int) values[1];
+        row.energy = values[2];
+        row.psi = values[3];
+        row.im = values[4];
+        row.gnd = values[5];
+        row.trig = (int) values[6];
+        row.mono_psi = values[7];
+        row.mono_im = values[8];
+        row.mono_gnd = values[9];
+        row.chkv = (int) values[10];
+        row.chkv_psi = values[11];
+        row.chkv_im = values[12];
+        row.chkv_gnd = values[13];
+        row.weight = n_read > n_required ? values[14] : 1.0;
+        row.realization = n_read > n_required + 1 ? (int) values[15] : 0;
+        return true;
+    }
+
+    int ResultPlotter::Run(int argc, const char* argv[])
+    {
+        if (argc < 3)
+        {
+            cout << "Usage: cherenkov_plot <output file> <result file>..." << endl;
+            return -1;
+        }
+        string output_file = argv[1];
+        vector<string> input_files = vector<string>(argv + 2, argv + argc);
+
+        // Each thread takes the next unread file and fills its own plots, which are added together at the end.
+        ROOT::EnableThreadSafety();
+        size_t n_threads = min(input_files.size(), (size_t) max(thread::hardware_concurrency(), 1u));
+        vector<unique_ptr<ResultPlotter>> plotters = vector<unique_ptr<ResultPlotter>>();
+        vector<string> errors = vector<string>(n_threads);
+        vector<thread> threads = vector<thread>();
+        atomic<size_t> next_file(0);
+        for (size_t i = 0; i < n_threads; i++)
+            plotters.emplace_back(new ResultPlotter());
+        auto work = [&](size_t i)
+        {
+            try
+            {
+                for (size_t j = next_file++; j < input_files.size(); j = next_file++)
+                    plotters[i]->FillFile(input_files[j]);
+            }
+            catch (runtime_error& err)
+            {
+                errors[i] = err.what();
+            }
+        };
+        for (size_t i = 0; i < n_threads; i++)
+            threads.emplace_back(work, i);
+        for (thread& worker : threads)
+            worker.join();
+        for (const string& error : errors)
+        {
+            if (error.empty()) continue;
+            cout << error << endl;
+            return -1;
+        }
+
+        for (size_t i = 1; i < n_threads; i++)
+            plotters[0]->Add(*plotters[i]);
+        TFile file(output_file.c_str(), "RECREATE");
+        if (file.IsZombie())
+        {
+            cout << "The file " << output_file << " could not be opened. Check the path." << endl;
+            return -1;
+        }
+        plotters[0]->Write();
+        return 0;
+    }
+}
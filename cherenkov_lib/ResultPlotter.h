@@ -0,0 +1,98 @@
+// ResultPlotter.h
+//
+// Author: Matthew Dutson
+//
+// Definition of ResultPlotter class
+
+#ifndef RESULT_PLOTTER_H
+#define RESULT_PLOTTER_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <TH1F.h>
+#include <TProfile.h>
+
+#include "OutputWriter.h"
+
+namespace cherenkov_simulator
+{
+    /*
+     * Fills the reconstruction error histograms and profiles of run_output/PlotResults.cpp in a single pass over the
+     * results. Each row is read once and added to every plot, rather than rescanning the results once per plot with
+     * TTree::Draw. Plots from separate ResultPlotters can be added together, so files can be processed in parallel.
+     * Only rows where a Cherenkov reconstruction was tried are used, as in PlotResults. Each row is filled with its
+     * weight.
+     */
+    class ResultPlotter
+    {
+    public:
+
+        /*
+         * Creates empty plots with the same names and binning as PlotResults.
+         */
+        ResultPlotter();
+
+        /*
+         * Adds a single row of results to every plot.
+         */
+        void Fill(const ResultRow& row);
+
+        /*
+         * Adds every row of a results file. Files ending in .root are read from their "results" tree, and anything
+         * else is parsed as a CSV file written by MonteCarlo. Throws a runtime_error if the file can't be read.
+         */
+        void FillFile(std::string filename);
+
+        /*
+         * Adds the contents of another plotter to this one.
+         */
+        void Add(const ResultPlotter& other);
+
+        /*
+         * Writes each plot and a canvas for each monocular/Cherenkov pair to the current directory, in the same form
+         * as PlotResults.
+         */
+        void Write();
+
+        /*
+         * Parses a line of a MonteCarlo CSV file. Returns false if the line isn't a row of results (for example, a
+         * header). Lines without a weight column are given a weight of one.
+         */
+        static bool ParseLine(std::string line, ResultRow& row);
+
+        /*
+         * Parses the output file and a list of result files from command line arguments, fills the plots from all of
+         * the result files using one thread per file (up to the number of cores), and writes them to the output file.
+         */
+        static int Run(int argc, const char* argv[]);
+
+    private:
+
+        /*
+         * The parameters of a monocular/Cherenkov pair of plots. Histograms have no axis labels.
+         */
+        struct Params
+        {
+            const char* mono_name;
+            const char* chkv_name;
+            const char* mono_strn;
+            const char* chkv_strn;
+            const char* canv_name;
+            int n_bins;
+            double min;
+            double max;
+            const char* x_lab;
+            const char* y_lab;
+        };
+
+        static const std::vector<Params> histo_params;
+        static const std::vector<Params> prof_params;
+
+        // Stored as monocular/Cherenkov pairs in the order of the parameter lists.
+        std::vector<std::unique_ptr<TH1F>> histos;
+        std::vector<std::unique_ptr<TProfile>> profiles;
+    };
+}
+
+#endif
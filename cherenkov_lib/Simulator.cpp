@@ -32,36 +32,75 @@ namespace cherenkov_simulator
         mainmirr_size = stop_diameter + 2.0 * mirror_radius * Tan(view_rad / 2.0);
         pmtclust_size = mirror_radius * Sin(view_rad / 2.0);
 
-        count_params.bin_size = config.get<double>("simulation.bin_size");
-        count_params.max_byte = config.get<size_t>("simulation.max_byte");
-        count_params.n_pixels = config.get<size_t>("detector.n_pixels");
-        count_params.lin_size = pmtclust_size / count_params.n_pixels;
-        count_params.ang_size = count_params.lin_size / (mirror_radius / 2.0);
+        count_params = MakeCountParams(config);
 
         ckv_integrator = TF1("ckv_integrator", ckv_func, 0.0, Infinity(), 3);
         ckv_integrator.SetParNames("age", "rho", "del");
     }
 
-    PhotonCount Simulator::SimulateShower(Shower shower) const
+    PhotonCount Simulator::SimulateShower(Shower shower, ShowerProfile* profile, unsigned int seed) const
     {
         TF1 integrator = TF1(ckv_integrator);
 
         PhotonCount photon_count = PhotonCount(count_params, MinTime(shower), MaxTime(shower));
-        while (shower.TimeToPlane(ground_plane) > 0)
+        for (long step = 0; shower.TimeToPlane(ground_plane) > 0; step++)
         {
+            if (seed != 0) Utility::Rng().SetSeed(Utility::DeriveSeed(seed, step));
             shower.IncrementDepth(depth_step);
-            ViewFluorescencePhotons(shower, photon_count);
-            ViewCherenkovPhotons(shower, ground_plane, photon_count, integrator);
+            ViewFluorescencePhotons(shower, photon_count, profile);
+            ViewCherenkovPhotons(shower, ground_plane, photon_count, integrator, profile);
         }
         photon_count.Trim();
         return photon_count;
     }
 
+    double Simulator::EstimatePeakSignal(Shower shower) const
+    {
+        // The Gaisser-Hillas profile is broad, so a much coarser step than the simulation's is enough.
+        double step = 10.0 * depth_step;
+        double peak = 0.0;
+        while (shower.TimeToPlane(ground_plane) > 0)
+        {
+            shower.IncrementDepth(step);
+            TVector3 view_point = shower.Position();
+            double distance = view_point.Mag();
+            double cos_psi = -shower.Direction().Dot(view_point) / distance;
+            double sin_psi = Sqrt(1.0 - Sq(cos_psi));
+
+            // A shower heading toward the detector compresses its light into a short time, so this can be infinite.
+            double pixel_length = sin_psi > 0.0 ? count_params.ang_size * distance / sin_psi : Infinity();
+            double bin_length = cos_psi < 1.0 ? c_cent * count_params.bin_size / (1.0 - cos_psi) : Infinity();
+            double per_length = FluorescenceYield(shower) * shower.GaisserHillas() * shower.LocalRho();
+            double fraction = SphereFraction(view_point) * DetectorEfficiency();
+            peak = Max(peak, per_length * fraction * Min(pixel_length, bin_length));
+        }
+        return peak;
+    }
+
     Plane Simulator::GroundPlane() const
     {
         return ground_plane;
     }
 
+    PhotonCount::Params Simulator::CountParams() const
+    {
+        return count_params;
+    }
+
+    PhotonCount::Params Simulator::MakeCountParams(const ptree& config)
+    {
+        double mirror_radius = config.get<double>("detector.mirror_radius");
+        double pmtclust_size = mirror_radius * Sin(config.get<double>("detector.view_rad") / 2.0);
+
+        PhotonCount::Params params = PhotonCount::Params();
+        params.bin_size = config.get<double>("simulation.bin_size");
+        params.max_byte = config.get<size_t>("simulation.max_byte");
+        params.n_pixels = config.get<size_t>("detector.n_pixels");
+        params.lin_size = pmtclust_size / params.n_pixels;
+        params.ang_size = params.lin_size / (mirror_radius / 2.0);
+        return params;
+    }
+
     double Simulator::CherenkovFunc::operator()(double* x, double* p)
     {
         // Parameters are named in the simulator constructor.
@@ -80,39 +119,58 @@ namespace cherenkov_simulator
         return a0 * Exp(dep) / ((a1 + Exp(dep)) * Power(a2 + Exp(dep), age)) * (k_1 - k_2 * Exp(-2.0 * dep));
     }
 
-    void Simulator::ViewFluorescencePhotons(Shower shower, PhotonCount& photon_count) const
+    void Simulator::ViewFluorescencePhotons(Shower shower, PhotonCount& photon_count, ShowerProfile* profile) const
     {
+        PROFILE_STAGE(profile, fluorescence);
         int n_loops = NumberFluorescenceLoops(shower);
+        PROFILE_COUNT(profile, flor_photons, n_loops / flor_thin);
+        vector<Ray> photons = vector<Ray>();
+        photons.reserve(n_loops / flor_thin);
         for (int i = 0; i < n_loops / flor_thin; i++)
         {
             TVector3 lens_impact = rot_to_world * RandomStopImpact();
             Ray photon = JitteredRay(shower, lens_impact - shower.Position());
             photon.PropagateToPoint(lens_impact);
-            SimulateOptics(photon, photon_count, flor_thin);
+            photons.push_back(photon);
         }
+        TracePhotons(photons, photon_count, flor_thin, PhotonFunnel::fluorescence, profile);
     }
 
-    void Simulator::ViewCherenkovPhotons(Shower shower, Plane ground_plane, PhotonCount& photon_count, TF1 integrator) const
+    void Simulator::ViewCherenkovPhotons(Shower shower, Plane ground_plane, PhotonCount& photon_count, TF1 integrator,
+                                         ShowerProfile* profile) const
     {
+        PROFILE_STAGE(profile, cherenkov);
         int n_loops = NumberCherenkovLoops(shower, integrator);
+        PROFILE_COUNT(profile, chkv_photons, n_loops);
+        vector<Ray> photons = vector<Ray>();
+        photons.reserve(n_loops);
         for (int i = 0; i < n_loops; i++)
         {
             Ray photon = GenerateCherenkovPhoton(shower);
             photon.PropagateToPlane(ground_plane);
             TVector3 stop_impact = rot_to_world * RandomStopImpact();
             photon.PropagateToPoint(stop_impact);
-            SimulateOptics(photon, photon_count, chkv_thin);
+            photons.push_back(photon);
         }
+        TracePhotons(photons, photon_count, chkv_thin, PhotonFunnel::cherenkov, profile);
     }
 
-    int Simulator::NumberFluorescenceLoops(Shower shower) const
+    void Simulator::TracePhotons(const vector<Ray>& photons, PhotonCount& photon_count, int thinning,
+                                 PhotonFunnel::Source source, ShowerProfile* profile) const
     {
-        double rho = shower.LocalRho();
-        double term_1 = fluor_a1 / (1 + fluor_b1 * rho * Sqrt(atm_temp));
-        double term_2 = fluor_a2 / (1 + fluor_b2 * rho * Sqrt(atm_temp));
-        double yield = IonizationLossRate(shower) / edep_1_4 * (term_1 + term_2);
+        // The optics don't draw random numbers, so tracing the photons of a step together doesn't change the result.
+        // It lets the whole batch be timed at once, since a timer per photon would cost more than some photons.
+        PROFILE_STAGE(profile, optics);
+        for (const Ray& photon : photons)
+        {
+            PhotonFunnel::Outcome outcome = SimulateOptics(photon, photon_count, thinning);
+            if (profile != nullptr) profile->funnel.counts[source][outcome]++;
+        }
+    }
 
-        double total = yield * shower.GaisserHillas() * depth_step;
+    int Simulator::NumberFluorescenceLoops(Shower shower) const
+    {
+        double total = FluorescenceYield(shower) * shower.GaisserHillas() * depth_step;
         double fraction = SphereFraction(shower.Position()) * DetectorEfficiency();
         return Utility::RandomRound(total * fraction / (double) flor_thin);
     }
@@ -131,28 +189,36 @@ namespace cherenkov_simulator
         return Utility::RandomRound(total * fraction / (double) chkv_thin);
     }
 
-    void Simulator::SimulateOptics(Ray photon, PhotonCount& photon_count, int thinning) const
+    PhotonFunnel::Outcome Simulator::SimulateOptics(Ray photon, PhotonCount& photon_count, int thinning) const
     {
         photon.Transform(rot_to_world.Inverse());
-        if (!DeflectFromLens(photon)) return;
+        if (!DeflectFromLens(photon)) return PhotonFunnel::lens;
 
         TVector3 camera_impact;
-        if (CameraImpactPoint(photon, camera_impact)) return;
+        if (CameraImpactPoint(photon, camera_impact)) return PhotonFunnel::blocked;
 
         TVector3 reflect_point;
-        if (!MirrorImpactPoint(photon, reflect_point)) return;
+        if (!MirrorImpactPoint(photon, reflect_point)) return PhotonFunnel::mirror;
         photon.PropagateToPoint(reflect_point);
         photon.Reflect(MirrorNormal(reflect_point));
 
-        if (!CameraImpactPoint(photon, camera_impact)) return;
+        if (!CameraImpactPoint(photon, camera_impact)) return PhotonFunnel::camera;
         photon.PropagateToPoint(camera_impact);
-        photon_count.AddPhoton(photon.Time(), camera_impact, thinning);
+        switch (photon_count.AddPhoton(photon.Time(), camera_impact, thinning))
+        {
+            case PhotonCount::AddResult::out_of_range:
+                return PhotonFunnel::out_of_range;
+            case PhotonCount::AddResult::out_of_time:
+                return PhotonFunnel::out_of_time;
+            default:
+                return PhotonFunnel::detected;
+        }
     }
 
     TVector3 Simulator::RandomStopImpact() const
     {
         double r_rand = Utility::RandLinear(0.0, stop_diameter / 2.0);
-        double phi_rand = gRandom->Uniform(TwoPi());
+        double phi_rand = Utility::Rng().Uniform(TwoPi());
         return TVector3(r_rand * Cos(phi_rand), r_rand * Sin(phi_rand), 0);
     }
 
@@ -193,6 +259,14 @@ namespace cherenkov_simulator
         return ion_c1 / Power(ion_c2 + age, ion_c3) + ion_c4 + ion_c5 * age;
     }
 
+    double Simulator::FluorescenceYield(Shower shower) const
+    {
+        double rho = shower.LocalRho();
+        double term_1 = fluor_a1 / (1 + fluor_b1 * rho * Sqrt(atm_temp));
+        double term_2 = fluor_a2 / (1 + fluor_b2 * rho * Sqrt(atm_temp));
+        return IonizationLossRate(shower) / edep_1_4 * (term_1 + term_2);
+    }
+
     double Simulator::SphereFraction(TVector3 view_point) const
     {
         TVector3 detector_axis = rot_to_world * TVector3(0, 0, 1);
@@ -211,7 +285,7 @@ namespace cherenkov_simulator
     {
         TVector3 direction = shower.Direction();
         TVector3 rotation_axis = Utility::RandNormal(shower.Velocity().Unit());
-        direction.Rotate(gRandom->Exp(ThetaC(shower)), rotation_axis);
+        direction.Rotate(Utility::Rng().Exp(ThetaC(shower)), rotation_axis);
         return JitteredRay(shower, direction);
     }
 
@@ -223,7 +297,7 @@ namespace cherenkov_simulator
     Ray Simulator::JitteredRay(Shower shower, TVector3 direction) const
     {
         double step_time = depth_step / shower.LocalRho() / c_cent;
-        double offset = gRandom->Uniform(-0.5 * step_time, 0.5 * step_time);
+        double offset = Utility::Rng().Uniform(-0.5 * step_time, 0.5 * step_time);
         double time = shower.Time() + offset;
         TVector3 position = shower.Position() + shower.Velocity() * offset;
         return Ray(position, direction, time);
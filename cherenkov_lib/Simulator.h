@@ -14,6 +14,7 @@
 
 #include "DataStructures.h"
 #include "Geometric.h"
+#include "Profiler.h"
 #include "Utility.h"
 
 namespace cherenkov_simulator
@@ -33,18 +34,43 @@ namespace cherenkov_simulator
         /*
          * Simulate the motion of the shower from its current point to the ground, emitting fluorescence and Cherenkov
          * photons at each depth step. Ray trace these photons through the Schmidt detector and record their impact
-         * positions. Add Poisson-distributed background noise.
+         * positions. If a profile is passed, the time spent generating and tracing photons is added to it, and the fate
+         * of each photon is counted in its funnel. If a nonzero seed is passed, the RNG of the calling thread is
+         * reseeded at every depth step with a seed derived from it and the step number, so the result doesn't depend
+         * on any draws made before the call.
          */
-        PhotonCount SimulateShower(Shower shower) const;
+        PhotonCount SimulateShower(Shower shower, ShowerProfile* profile = nullptr, unsigned int seed = 0) const;
+
+        /*
+         * Estimates the largest mean number of fluorescence photons the shower will put into a single time bin of a
+         * single pixel, without tracing any photons. At coarse depth steps, the photons reaching the detector per unit
+         * length of the track are multiplied by the length of track seen by one pixel, or by the length whose light
+         * arrives within one time bin if that is shorter. Noise, Cherenkov light, and the spot size of the optics are
+         * ignored, so the estimate should be compared to the trigger threshold with a safety margin.
+         */
+        double EstimatePeakSignal(Shower shower) const;
 
         /*
          * Returns a copy of the ground plane.
          */
         Plane GroundPlane() const;
 
+        /*
+         * Returns the parameters used to construct the PhotonCount of each shower.
+         */
+        PhotonCount::Params CountParams() const;
+
+        /*
+         * Computes the PhotonCount parameters from the detector and simulation settings of the configuration tree, so
+         * that classes other than Simulator can find the pixel geometry without constructing one.
+         */
+        static PhotonCount::Params MakeCountParams(const boost::property_tree::ptree& config);
+
 
     private:
 
+        friend class HotPaths;
+
         /*
          * Represents the integrand of the Cherenkov yield.
          */
@@ -82,13 +108,14 @@ namespace cherenkov_simulator
         /*
          * Simulate the production and detection of the fluorescence photons.
          */
-        void ViewFluorescencePhotons(Shower shower, PhotonCount& photon_count) const;
+        void ViewFluorescencePhotons(Shower shower, PhotonCount& photon_count, ShowerProfile* profile) const;
 
         /*
          * Simulate the production and detection of the Cherenkov photons. Only Cherenkov photons reflected from the
          * ground are recorded (no back scattering).
          */
-        void ViewCherenkovPhotons(Shower shower, Plane ground_plane, PhotonCount& photon_count, TF1 integrator) const;
+        void ViewCherenkovPhotons(Shower shower, Plane ground_plane, PhotonCount& photon_count, TF1 integrator,
+                                  ShowerProfile* profile) const;
 
         /*
          * Determines the total number of Fluorescence photons produced by the shower at a particular point.
@@ -107,9 +134,17 @@ namespace cherenkov_simulator
          * optics. If the photon is somehow blocked or doesn't reach the photomultiplier array, no change to the photon
          * count structure is made. Otherwise, the appropriate bin of the photon counter is incremented. Takes a
          * parameter which represents the rate of computational thinning. This is passed to the photon count container
-         * to allow it to increment bins by the correct amount.
+         * to allow it to increment bins by the correct amount. Returns the step at which the photon was lost, or
+         * PhotonFunnel::detected.
+         */
+        PhotonFunnel::Outcome SimulateOptics(Ray photon, PhotonCount& photon_count, int thinning) const;
+
+        /*
+         * Simulates the optics for each of the photons generated in one depth step, counting their outcomes in the
+         * funnel of the specified source.
          */
-        void SimulateOptics(Ray photon, PhotonCount& photon_count, int thinning) const;
+        void TracePhotons(const std::vector<Ray>& photons, PhotonCount& photon_count, int thinning,
+                          PhotonFunnel::Source source, ShowerProfile* profile) const;
 
         /*
          * Generates a random point on the circle of the refracting lens.
@@ -145,6 +180,12 @@ namespace cherenkov_simulator
          */
         double IonizationLossRate(Shower shower) const;
 
+        /*
+         * Calculates the number of fluorescence photons emitted per particle per unit of slant depth at the current
+         * position of the shower.
+         */
+        double FluorescenceYield(Shower shower) const;
+
         /*
          * Calculates how large, as a fraction of a sphere, the detector stop appears from some point. This accounts
          * both for the inverse square dependance and the orientation of the detector.
@@ -0,0 +1,191 @@
+// Statistics.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of Statistics.h
+
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <TMath.h>
+
+#include "Statistics.h"
+
+using namespace std;
+using namespace boost::property_tree;
+
+namespace cherenkov_simulator
+{
+    RunningStat::RunningStat()
+    {
+        count = 0;
+        sum_w = 0;
+        sum_w2 = 0;
+        mean = 0;
+        m2 = 0;
+    }
+
+    void RunningStat::Add(double value, double weight)
+    {
+        if (weight <= 0) return;
+        count++;
+        sum_w += weight;
+        sum_w2 += weight * weight;
+        double delta = value - mean;
+        mean += delta * weight / sum_w;
+        m2 += weight * delta * (value - mean);
+    }
+
+    void RunningStat::Add(const RunningStat& other)
+    {
+        if (other.count == 0) return;
+        double total = sum_w + other.sum_w;
+        double delta = other.mean - mean;
+        mean += delta * other.sum_w / total;
+        m2 += other.m2 + delta * delta * sum_w * other.sum_w / total;
+        count += other.count;
+        sum_w = total;
+        sum_w2 += other.sum_w2;
+    }
+
+    long RunningStat::Count() const
+    {
+        return count;
+    }
+
+    double RunningStat::SumWeights() const
+    {
+        return sum_w;
+    }
+
+    double RunningStat::EffectiveCount() const
+    {
+        if (count == 0) return 0;
+        return sum_w * sum_w / sum_w2;
+    }
+
+    double RunningStat::Mean() const
+    {
+        return mean;
+    }
+
+    double RunningStat::Variance() const
+    {
+        if (count < 2) return 0;
+        return m2 / (sum_w - sum_w2 / sum_w);
+    }
+
+    double RunningStat::StdError() const
+    {
+        if (count < 2) return numeric_limits<double>::infinity();
+        return sqrt(Variance() * sum_w2) / sum_w;
+    }
+
+    string RunningStat::ToString() const
+    {
+        stringstream out = stringstream();
+        out << setprecision(17) << count << " " << sum_w << " " << sum_w2 << " " << mean << " " << m2;
+        return out.str();
+    }
+
+    RunningStat RunningStat::FromString(string state)
+    {
+        stringstream in = stringstream(state);
+        RunningStat stat = RunningStat();
+        if (!(in >> stat.count >> stat.sum_w >> stat.sum_w2 >> stat.mean >> stat.m2))
+            throw invalid_argument("The statistics \"" + state + "\" could not be parsed.");
+        return stat;
+    }
+
+    ConvergenceMonitor::ConvergenceMonitor(const ptree& config)
+    {
+        auto_stop = config.get<bool>("convergence.auto_stop");
+        confidence = config.get<double>("convergence.confidence");
+        if (confidence <= 0 || confidence >= 1) throw runtime_error("The confidence level must be between 0 and 1.");
+        z_score = TMath::NormQuantile(0.5 + confidence / 2);
+        min_showers = config.get<int>("convergence.min_showers");
+        report_every = config.get<int>("convergence.report_every");
+        tolerance[trig_eff] = config.get<double>("convergence.trig_toler");
+        tolerance[mono_im] = config.get<double>("convergence.mono_im_toler");
+        tolerance[mono_psi] = config.get<double>("convergence.mono_psi_toler");
+        tolerance[chkv_im] = config.get<double>("convergence.chkv_im_toler");
+        tolerance[chkv_psi] = config.get<double>("convergence.chkv_psi_toler");
+    }
+
+    vector<RunningStat> ConvergenceMonitor::EmptyStats()
+    {
+        return vector<RunningStat>(n_quantities);
+    }
+
+    void ConvergenceMonitor::Add(vector<RunningStat>& stats, const ResultRow& row)
+    {
+        stats[trig_eff].Add(row.trig, row.weight);
+        if (!row.trig) return;
+        stats[mono_im].Add((row.mono_im - row.im) / row.im, row.weight);
+        stats[mono_psi].Add(row.mono_psi - row.psi, row.weight);
+        if (!row.chkv) return;
+        stats[chkv_im].Add((row.chkv_im - row.im) / row.im, row.weight);
+        stats[chkv_psi].Add(row.chkv_psi - row.psi, row.weight);
+    }
+
+    double ConvergenceMonitor::MeanWidth(const RunningStat& stat) const
+    {
+        return 2 * z_score * stat.StdError();
+    }
+
+    double ConvergenceMonitor::SpreadWidth(const RunningStat& stat) const
+    {
+        if (stat.Count() < 2 || stat.EffectiveCount() <= 1) return numeric_limits<double>::infinity();
+        return 2 * z_score * sqrt(stat.Variance() / (2 * (stat.EffectiveCount() - 1)));
+    }
+
+    bool ConvergenceMonitor::Converged(const vector<RunningStat>& stats) const
+    {
+        for (int i = 0; i < n_quantities; i++)
+        {
+            if (tolerance[i] <= 0) continue;
+            if (stats[i].Count() < min_showers || MeanWidth(stats[i]) > tolerance[i]) return false;
+            if (i != trig_eff && SpreadWidth(stats[i]) > tolerance[i]) return false;
+        }
+        return true;
+    }
+
+    bool ConvergenceMonitor::AutoStop() const
+    {
+        return auto_stop;
+    }
+
+    bool ConvergenceMonitor::ReportDue(int n_triggered) const
+    {
+        return report_every > 0 && n_triggered % report_every == 0;
+    }
+
+    string ConvergenceMonitor::Summary(const vector<RunningStat>& stats) const
+    {
+        const char* names[] = {"Trigger efficiency", "Mono impact parameter error", "Mono impact angle error",
+                               "Cherenkov impact parameter error", "Cherenkov impact angle error"};
+        stringstream out = stringstream();
+        out << "Estimates with " << 100 * confidence << "% intervals:";
+        for (int i = 0; i < n_quantities; i++)
+        {
+            double mean = stats[i].Mean();
+            double mean_half = MeanWidth(stats[i]) / 2;
+            out << endl << "    " << names[i] << ": ";
+            if (i == trig_eff)
+            {
+                out << mean << " [" << mean - mean_half << ", " << mean + mean_half << "]";
+            }
+            else
+            {
+                double spread = sqrt(stats[i].Variance());
+                double spread_half = SpreadWidth(stats[i]) / 2;
+                out << "bias " << mean << " [" << mean - mean_half << ", " << mean + mean_half << "], resolution "
+                    << spread << " [" << spread - spread_half << ", " << spread + spread_half << "]";
+            }
+            out << " from " << stats[i].Count() << (tolerance[i] > 0 ? "" : " (not monitored)");
+        }
+        return out.str();
+    }
+}
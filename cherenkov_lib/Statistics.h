@@ -0,0 +1,176 @@
+// Statistics.h
+//
+// Author: Matthew Dutson
+//
+// Definitions of RunningStat, which accumulates the mean and variance of a stream of weighted values without storing
+// them, and ConvergenceMonitor, which uses these to decide when a Monte Carlo run has settled.
+
+#ifndef STATISTICS_H
+#define STATISTICS_H
+
+#include <string>
+#include <vector>
+#include <boost/property_tree/ptree.hpp>
+
+#include "OutputWriter.h"
+
+namespace cherenkov_simulator
+{
+    /*
+     * The weighted mean and variance of the values added so far, updated one value at a time with West's algorithm.
+     * Weights are treated as reliability weights, so the standard error uses the effective number of values. With
+     * unit weights, the results are the usual sample mean, sample variance, and standard error of the mean.
+     */
+    class RunningStat
+    {
+    public:
+
+        /*
+         * Constructs a RunningStat with no values.
+         */
+        RunningStat();
+
+        /*
+         * Adds a value with the specified weight. Values with a non-positive weight are ignored.
+         */
+        void Add(double value, double weight = 1.0);
+
+        /*
+         * Adds every value accumulated by another RunningStat, as if they had been added to this one.
+         */
+        void Add(const RunningStat& other);
+
+        /*
+         * The number of values added.
+         */
+        long Count() const;
+
+        /*
+         * The sum of the weights of the values added.
+         */
+        double SumWeights() const;
+
+        /*
+         * The effective number of values, (sum of weights)^2 / (sum of squared weights). Equal to Count() if every
+         * weight is the same.
+         */
+        double EffectiveCount() const;
+
+        /*
+         * The weighted mean, or zero if no values have been added.
+         */
+        double Mean() const;
+
+        /*
+         * The unbiased weighted variance, or zero if fewer than two values have been added.
+         */
+        double Variance() const;
+
+        /*
+         * The standard error of the weighted mean. Infinite if fewer than two values have been added, so that a
+         * precision target is never met too early.
+         */
+        double StdError() const;
+
+        /*
+         * Writes the state of the accumulator as space-separated numbers, with enough digits to read it back exactly.
+         */
+        std::string ToString() const;
+
+        /*
+         * Reads an accumulator written by ToString(). Throws an invalid_argument if the string can't be parsed.
+         */
+        static RunningStat FromString(std::string state);
+
+    private:
+
+        long count;
+        double sum_w;
+        double sum_w2;
+        double mean;
+        double m2;
+    };
+
+    /*
+     * Tracks running estimates of the trigger efficiency and of the bias and resolution of the mono and Cherenkov
+     * reconstructions, with confidence intervals. The bias and resolution are the mean and standard deviation of the
+     * relative impact parameter error, (mono_im - im) / im, and of the impact angle error, mono_psi - psi (and the same
+     * for chkv). The accumulated values are kept by the caller, so they can be saved along with the rest of a run.
+     * The resolution interval uses the normal approximation to the standard error of a standard deviation.
+     */
+    class ConvergenceMonitor
+    {
+    public:
+
+        /*
+         * The quantities which are accumulated. The trigger efficiency accumulates one value per attempted shower,
+         * and the rest one value per triggered (or, for chkv, Cherenkov-reconstructed) shower.
+         */
+        enum Quantity
+        {
+            trig_eff,
+            mono_im,
+            mono_psi,
+            chkv_im,
+            chkv_psi,
+            n_quantities
+        };
+
+        /*
+         * Copies the confidence level, tolerances, and stopping parameters from the parsed XML file.
+         */
+        explicit ConvergenceMonitor(const boost::property_tree::ptree& config);
+
+        /*
+         * Returns a set of accumulators with no values, one for each quantity.
+         */
+        static std::vector<RunningStat> EmptyStats();
+
+        /*
+         * Adds the outcome of one attempted shower. Untriggered showers only count towards the trigger efficiency.
+         */
+        static void Add(std::vector<RunningStat>& stats, const ResultRow& row);
+
+        /*
+         * The full width of the confidence interval of the mean of a quantity.
+         */
+        double MeanWidth(const RunningStat& stat) const;
+
+        /*
+         * The full width of the confidence interval of the standard deviation of a quantity.
+         */
+        double SpreadWidth(const RunningStat& stat) const;
+
+        /*
+         * Determines whether every monitored quantity has at least min_showers values and intervals no wider than its
+         * tolerance. Quantities with a tolerance of zero aren't monitored.
+         */
+        bool Converged(const std::vector<RunningStat>& stats) const;
+
+        /*
+         * Whether a run should stop as soon as Converged() is true.
+         */
+        bool AutoStop() const;
+
+        /*
+         * Whether a progress report is due after the specified number of triggered showers.
+         */
+        bool ReportDue(int n_triggered) const;
+
+        /*
+         * Returns a table of the current estimates and their confidence intervals.
+         */
+        std::string Summary(const std::vector<RunningStat>& stats) const;
+
+    private:
+
+        bool auto_stop;
+        double confidence;
+        double z_score;
+        int min_showers;
+        int report_every;
+        double tolerance[n_quantities];
+    };
+}
+
+#endif
@@ -4,7 +4,9 @@
 //
 // Implementation of Utility.h
 
+#include <cstdint>
 #include <fstream>
+#include <utility>
 #include <boost/property_tree/xml_parser.hpp>
 #include <TRandom3.h>
 #include <TRotation.h>
@@ -57,6 +59,22 @@ namespace cherenkov_simulator
         return rotate;
     }
 
+    void Utility::ApplyOverlay(ptree& config, const ptree& overlay)
+    {
+        for (const auto& child : overlay)
+        {
+            if (child.first == "<xmlattr>" || child.first == "<xmlcomment>") continue;
+            boost::optional<ptree&> existing = config.get_child_optional(child.first);
+            ptree& target = existing ? *existing : config.add_child(child.first, ptree());
+
+            bool leaf = true;
+            for (const auto& grandchild : child.second)
+                if (grandchild.first != "<xmlattr>" && grandchild.first != "<xmlcomment>") leaf = false;
+            if (leaf) target.data() = child.second.data();
+            else ApplyOverlay(target, child.second);
+        }
+    }
+
     bool Utility::WithinXYDisk(TVector3 vec, double radius)
     {
         return Sqrt(Sq(vec.X()) + Sq(vec.Y())) < radius;
@@ -72,7 +90,7 @@ namespace cherenkov_simulator
         {
             TVector3 other_vec = vec + TVector3(1, 0, 0);
             TVector3 normal = (vec.Cross(other_vec)).Unit();
-            normal.Rotate(gRandom->Uniform(2 * TMath::Pi()), vec);
+            normal.Rotate(Rng().Uniform(2 * TMath::Pi()), vec);
             return normal;
         }
     }
@@ -83,15 +101,32 @@ namespace cherenkov_simulator
             throw runtime_error("The bounds must be non-negative");
         if (min >= max)
             throw runtime_error("The min bound must be less than the max bound");
-        return Sqrt((Sq(max) - Sq(min)) * gRandom->Rndm() + Sq(min));
+        return Sqrt((Sq(max) - Sq(min)) * Rng().Rndm() + Sq(min));
+    }
+
+    double Utility::RandCosine(double pow)
+    {
+        return CosineQuantile(Rng().Rndm(), pow);
+    }
+
+    double Utility::CosineQuantile(double u, double pow)
+    {
+        if (pow <= -1)
+            throw runtime_error("The power must be greater than -1");
+        return ASin(Power(u, 1.0 / (pow + 1)));
     }
 
-    double Utility::RandCosine()
+    double Utility::CosineDensity(double angle, double pow)
     {
-        return ASin(gRandom->Rndm());
+        return (pow + 1) * Power(Sin(angle), pow) * Cos(angle);
     }
 
     double Utility::RandPower(double min, double max, double pow)
+    {
+        return PowerQuantile(Rng().Rndm(), min, max, pow);
+    }
+
+    double Utility::PowerQuantile(double u, double min, double max, double pow)
     {
         if (min <= 0 || max <= 0)
             throw runtime_error("The bounds must be positive");
@@ -100,21 +135,75 @@ namespace cherenkov_simulator
 
         if (pow == -1)
         {
-            return min * Power(max / min, gRandom->Rndm());
+            return min * Power(max / min, u);
         }
         else
         {
             double a = Power(min, pow + 1);
             double b = Power(max, pow + 1);
-            return Power((b - a) * gRandom->Rndm() + a, 1.0 / (pow + 1));
+            return Power((b - a) * u + a, 1.0 / (pow + 1));
+        }
+    }
+
+    double Utility::PowerDensity(double value, double min, double max, double pow)
+    {
+        if (value < min || value > max) return 0.0;
+        if (pow == -1) return 1.0 / (value * Log(max / min));
+        return (pow + 1) * Power(value, pow) / (Power(max, pow + 1) - Power(min, pow + 1));
+    }
+
+    TRandom& Utility::Rng()
+    {
+        static thread_local TRandom3 rng;
+        return rng;
+    }
+
+    unsigned int Utility::DeriveSeed(unsigned int seed, long value)
+    {
+        // SplitMix64 finalizer, so consecutive values give unrelated seeds.
+        uint64_t z = (uint64_t) seed * 0x9E3779B97F4A7C15ull + (uint64_t) value;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        z ^= z >> 31;
+        auto derived = (unsigned int) (z >> 32);
+        return derived == 0 ? 1 : derived;
+    }
+
+    double Utility::Halton(long index, int dim, unsigned int seed)
+    {
+        static const int primes[] = {2, 3, 5, 7, 11, 13, 17, 19};
+        if (dim < 0 || dim >= 8)
+            throw out_of_range("Halton sequences are only defined for up to eight dimensions");
+        if (index < 0)
+            throw out_of_range("The index of a Halton point must be non-negative");
+
+        // Digits are scrambled down to double precision, including the zeros above the last digit of the index.
+        int base = primes[dim];
+        double factor = 1.0 / base;
+        double result = 0.0;
+        for (int level = 0; factor > 1e-16; level++)
+        {
+            int perm[19];
+            unsigned int perm_seed = DeriveSeed(DeriveSeed(seed, dim), level);
+            for (int i = 0; i < base; i++)
+                perm[i] = i;
+            for (int i = base - 1; i > 0; i--)
+            {
+                perm_seed = DeriveSeed(perm_seed, i);
+                swap(perm[i], perm[perm_seed % (i + 1)]);
+            }
+            result += perm[index % base] * factor;
+            index /= base;
+            factor /= base;
         }
+        return Max(result, 1e-16);
     }
 
     int Utility::RandomRound(double value)
     {
         double decimal = value - Floor(value);
         auto base = (int) (value - decimal);
-        if (gRandom->Rndm() < decimal) return base + 1;
+        if (Rng().Rndm() < decimal) return base + 1;
         else return base;
     }
 
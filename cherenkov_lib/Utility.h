@@ -13,6 +13,8 @@
 #include <boost/property_tree/ptree.hpp>
 #include <TVector3.h>
 
+class TRandom;
+
 namespace cherenkov_simulator
 {
     const double fine_s = 0.007297; // Fine structure constant
@@ -76,6 +78,9 @@ namespace cherenkov_simulator
     typedef std::vector<std::vector<std::vector<short>>> Short3D;
 
     typedef std::vector<double> Double1D;
+    typedef std::vector<std::vector<double>> Double2D;
+
+    typedef std::vector<std::vector<int>> Int2D;
 
     /*
      * Defines miscellaneous static methods which are globally accessible throughout the cherenkov_lib project (Utility
@@ -96,6 +101,12 @@ namespace cherenkov_simulator
          */
         static boost::property_tree::ptree ParseXMLFile(std::string filename);
 
+        /*
+         * Replaces values in a configuration with those in an overlay which has the same structure. Entries missing
+         * from the overlay are left alone, and XML attributes (units and notes) are ignored.
+         */
+        static void ApplyOverlay(boost::property_tree::ptree& config, const boost::property_tree::ptree& overlay);
+
         /*
          * Determines whether the xy projection of the vector lies within a disk centered at the origin.
          */
@@ -106,6 +117,19 @@ namespace cherenkov_simulator
          */
         static TRotation MakeRotation(double elevation_angle);
 
+        /*
+         * Returns the random number generator of the calling thread. Each thread has its own generator, so draws on
+         * one thread never shift the sequence seen by another. All random methods below draw from it.
+         */
+        static TRandom& Rng();
+
+        /*
+         * Mixes a value into a seed to produce a new seed. Chaining calls gives an independent seed for any position
+         * in a run, for instance (run seed, shower ID, stage, step). The result is never zero, since ROOT takes a zero
+         * seed as a request for a time-based one.
+         */
+        static unsigned int DeriveSeed(unsigned int seed, long value);
+
         /*
          * Generates a randomly rotated vector perpendicular to the input. If the input vector is zero, (1, 0, 0) is
          * returned.
@@ -118,15 +142,44 @@ namespace cherenkov_simulator
         static double RandLinear(double min, double max);
 
         /*
-         * Generates a random angle on (0, pi) weighted by a cosine.
+         * Generates a random angle on (0, pi/2) weighted by a cosine. If pow is nonzero, the weight is also multiplied
+         * by the sine to that power, which must be greater than -1.
+         */
+        static double RandCosine(double pow = 0.0);
+
+        /*
+         * Maps a number on (0, 1) to an angle distributed as in RandCosine(). This is the inverse of its CDF.
+         */
+        static double CosineQuantile(double u, double pow = 0.0);
+
+        /*
+         * Returns the normalized probability density of the distribution sampled by RandCosine().
          */
-        static double RandCosine();
+        static double CosineDensity(double angle, double pow = 0.0);
 
         /*
          * Generates a random number according to a power law distribution.
          */
         static double RandPower(double min, double max, double pow);
 
+        /*
+         * Maps a number on (0, 1) to a value distributed as in RandPower(). This is the inverse of its CDF.
+         */
+        static double PowerQuantile(double u, double min, double max, double pow);
+
+        /*
+         * Returns the normalized probability density of the distribution sampled by RandPower().
+         */
+        static double PowerDensity(double value, double min, double max, double pow);
+
+        /*
+         * Returns one coordinate of a point in a scrambled Halton sequence. The coordinate of dimension dim is the
+         * radical inverse of the index in the base of the dim-th prime, with the digits at each position shuffled by a
+         * permutation derived from the seed. Any run of consecutive indices covers (0, 1) evenly, and the shuffling
+         * removes the correlation between dimensions with large bases. Up to eight dimensions are supported.
+         */
+        static double Halton(long index, int dim, unsigned int seed);
+
         /*
          * Returns an integer which is randomly rounded up or down from the input double based on its decimal. For
          * instance, 3.2 would be rounded up to 4 20% of the time and down to 3 80% of the time.
@@ -0,0 +1,68 @@
+// WorkerPool.cpp
+//
+// Author: Matthew Dutson
+//
+// Implementation of WorkerPool.h
+
+#include <stdexcept>
+
+#include "WorkerPool.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    WorkerPool::WorkerPool(int n_threads)
+    {
+        if (n_threads < 1) throw invalid_argument("The number of threads must be at least one.");
+        stopping = false;
+        if (n_threads == 1) return;
+        for (int i = 0; i < n_threads; i++)
+            threads.emplace_back(&WorkerPool::Loop, this);
+    }
+
+    WorkerPool::~WorkerPool()
+    {
+        {
+            lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+            queue.clear();
+        }
+        changed.notify_all();
+        for (thread& worker : threads)
+            worker.join();
+    }
+
+    int WorkerPool::Depth() const
+    {
+        return threads.empty() ? 1 : 2 * (int) threads.size();
+    }
+
+    void WorkerPool::Push(function<void()> task)
+    {
+        if (threads.empty())
+        {
+            task();
+            return;
+        }
+        {
+            lock_guard<std::mutex> lock(mutex);
+            queue.push_back(move(task));
+        }
+        changed.notify_one();
+    }
+
+    void WorkerPool::Loop()
+    {
+        while (true)
+        {
+            unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (stopping) return;
+            function<void()> task = move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+            task();
+        }
+    }
+}
@@ -0,0 +1,86 @@
+// WorkerPool.h
+//
+// Author: Matthew Dutson
+//
+// Definition of WorkerPool, a fixed set of threads which run queued tasks
+
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cherenkov_simulator
+{
+    /*
+     * A fixed set of threads which take tasks from a queue until the pool is destroyed. Since the same threads run
+     * every task, anything they keep per thread, like the BufferPool and the RNG, carries over from one task to the
+     * next. With a single thread, tasks are run on the calling thread instead.
+     */
+    class WorkerPool
+    {
+    public:
+
+        /*
+         * Starts the threads. Throws an invalid_argument if n_threads is less than one.
+         */
+        explicit WorkerPool(int n_threads);
+
+        /*
+         * Discards any tasks which haven't started, waits for the rest to finish, and stops the threads.
+         */
+        ~WorkerPool();
+
+        WorkerPool(const WorkerPool&) = delete;
+        WorkerPool& operator=(const WorkerPool&) = delete;
+
+        /*
+         * Queues a task and returns a future holding its result, or the exception it threw. With a single thread, the
+         * task has finished by the time this returns.
+         */
+        template<class Result>
+        std::future<Result> Submit(std::function<Result()> task);
+
+        /*
+         * The number of tasks to keep queued so that no thread goes idle: one if tasks run on the calling thread, and
+         * two per thread otherwise.
+         */
+        int Depth() const;
+
+    private:
+
+        std::vector<std::thread> threads;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<std::function<void()>> queue;
+        bool stopping;
+
+        /*
+         * Adds a task to the queue, or runs it if there are no threads.
+         */
+        void Push(std::function<void()> task);
+
+        /*
+         * The body of each thread. Runs tasks until the pool is destroyed.
+         */
+        void Loop();
+    };
+
+    template<class Result>
+    std::future<Result> WorkerPool::Submit(std::function<Result()> task)
+    {
+        // A packaged_task can't be copied, so the queue holds a shared pointer to it.
+        auto packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+        std::future<Result> result = packaged->get_future();
+        Push([packaged]() { (*packaged)(); });
+        return result;
+    }
+}
+
+#endif
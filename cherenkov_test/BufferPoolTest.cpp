@@ -0,0 +1,101 @@
+// BufferPoolTest.cpp
+//
+// Author: Matthew Dutson
+//
+// Tests of BufferPool.h
+
+#include <future>
+#include <gtest/gtest.h>
+
+#include "BufferPool.h"
+#include "DataStructures.h"
+#include "WorkerPool.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    TEST(BufferPoolTest, Reuse)
+    {
+        /*
+         * Make sure a cube given back to the pool is handed out again, cleared and reshaped without moving its time
+         * series, and that the pool doesn't grow past its limit.
+         */
+        Short3D counts = BufferPool::TakeCounts(4, 10);
+        counts[1][2][3] = 5;
+        const short* series = counts[1][2].data();
+        BufferPool::GiveCounts(move(counts));
+        Short3D reused = BufferPool::TakeCounts(4, 8);
+        EXPECT_EQ(series, reused[1][2].data());
+        EXPECT_EQ(4, reused.size());
+        EXPECT_EQ(Short1D(8, 0), reused[1][2]);
+
+        Bool3D mask = BufferPool::TakeMask(4, 10);
+        mask[0][1][2] = true;
+        BufferPool::GiveMask(move(mask));
+        EXPECT_EQ(Bool1D(6, false), BufferPool::TakeMask(4, 6)[0][1]);
+
+        for (int i = 0; i < 20; i++)
+            BufferPool::GiveMask(BufferPool::TakeMask(2, 1));
+        vector<Bool3D> masks = vector<Bool3D>();
+        for (int i = 0; i < 20; i++)
+            masks.push_back(BufferPool::TakeMask(2, 1));
+        for (auto& taken : masks)
+            BufferPool::GiveMask(move(taken));
+        EXPECT_LE(BufferPool::NPooled(), 8);
+    }
+
+    TEST(BufferPoolTest, ReuseAcrossBatches)
+    {
+        /*
+         * Make sure the threads of a worker pool reuse cubes given back during earlier batches, so that only the first
+         * cube taken by each thread is allocated.
+         */
+        WorkerPool workers(2);
+        size_t hits = BufferPool::NHits();
+        for (int batch = 0; batch < 3; batch++)
+        {
+            vector<future<void>> tasks = vector<future<void>>();
+            for (int i = 0; i < 2; i++)
+                tasks.push_back(workers.Submit(function<void()>([]() {
+                    BufferPool::GiveCounts(BufferPool::TakeCounts(4, 10));
+                })));
+            for (auto& task : tasks)
+                task.get();
+        }
+        EXPECT_GE(BufferPool::NHits() - hits, 4u);
+    }
+
+    TEST(BufferPoolTest, PhotonCountAssignment)
+    {
+        /*
+         * Make sure assigning to a PhotonCount gives its old cube back to the pool, and that copying into a PhotonCount
+         * of the same shape doesn't need another cube.
+         */
+        PhotonCount::Params params = PhotonCount::Params();
+        params.n_pixels = 4;
+        params.max_byte = 4000000;
+        params.bin_size = 0.1;
+        params.ang_size = 0.08;
+        params.lin_size = 2.5;
+
+        // Empty the pool of counts so that nothing given back is turned away.
+        vector<Short3D> drained = vector<Short3D>();
+        for (int i = 0; i < 4; i++)
+            drained.push_back(BufferPool::TakeCounts(2, 1));
+        PhotonCount data = PhotonCount(params, 0.0, 0.95);
+        PhotonCount other = PhotonCount(params, 0.0, 0.95);
+        size_t pooled = BufferPool::NPooled();
+        size_t hits = BufferPool::NHits();
+
+        data = other;
+        EXPECT_EQ(pooled, BufferPool::NPooled());
+        EXPECT_EQ(hits, BufferPool::NHits());
+        data = move(other);
+        EXPECT_EQ(pooled, BufferPool::NPooled());
+        data = PhotonCount();
+        EXPECT_EQ(pooled + 1, BufferPool::NPooled());
+        for (auto& cube : drained)
+            BufferPool::GiveCounts(move(cube));
+    }
+}
@@ -4,11 +4,17 @@
 //
 // Tests of DataStructures.h
 
+#include <algorithm>
+#include <fstream>
+#include <limits>
 #include <gtest/gtest.h>
 #include <TFile.h>
 
 #include "DataStructures.h"
 #include "Analysis.h"
+#include "EventIndex.h"
+#include "EventStore.h"
+#include "PhotonCodec.h"
 #include "Helper.h"
 
 using namespace std;
@@ -70,6 +76,18 @@ namespace cherenkov_simulator
         {
             return data.RealNoiseRate(rate);
         }
+
+        void FriendIncrementCell(PhotonCount& data, int inc, size_t x_index, size_t y_index, size_t t)
+        {
+            data.IncrementCell(inc, x_index, y_index, t);
+        }
+
+        void FriendSetTimeRange(PhotonCount& data, double frst_time, double last_time)
+        {
+            data.trimd = false;
+            data.frst_time = frst_time;
+            data.last_time = last_time;
+        }
     };
 
     /*
@@ -637,7 +655,7 @@ namespace cherenkov_simulator
         TVector3 direction = TVector3(0, 0, 1);
         direction.RotateX(0.12);
         direction.RotateY(-0.04);
-        data.AddPhoton(0.45, -direction, 3);
+        ASSERT_EQ(PhotonCount::AddResult::added, data.AddPhoton(0.45, -direction, 3));
         ASSERT_FALSE(data.Empty());
         PhotonCount::Iterator iter = data.GetIterator();
         iter.Next();
@@ -653,7 +671,7 @@ namespace cherenkov_simulator
     TEST_F(DataStructuresTest, AddInvalidPosition)
     {
         PhotonCount data = CopyEmpty();
-        data.AddPhoton(0.45, TVector3(0.0, 1.0, 0.0), 1);
+        ASSERT_EQ(PhotonCount::AddResult::out_of_range, data.AddPhoton(0.45, TVector3(0.0, 1.0, 0.0), 1));
         ASSERT_TRUE(data.Empty());
 
         PhotonCount::Iterator iter = data.GetIterator();
@@ -686,7 +704,7 @@ namespace cherenkov_simulator
     TEST_F(DataStructuresTest, AddInvalidTime)
     {
         PhotonCount data = CopyEmpty();
-        data.AddPhoton(-0.1, TVector3(0, 0, 1), 1);
+        ASSERT_EQ(PhotonCount::AddResult::out_of_time, data.AddPhoton(-0.1, TVector3(0, 0, 1), 1));
         ASSERT_TRUE(data.Empty());
 
         PhotonCount::Iterator iter = data.GetIterator();
@@ -694,6 +712,59 @@ namespace cherenkov_simulator
             ASSERT_EQ(0, data.SumBins(iter));
     }
 
+    /*
+     * Make sure sparse noise has the same total and the same fraction of nonzero bins as Poisson noise. With a mean of
+     * 0.05 per bin over 10000 bins, both are expected to be near 500 with a standard deviation near 22.
+     */
+    TEST_F(DataStructuresTest, SparseNoise)
+    {
+        PhotonCount data = PhotonCount(CopyParams(), 0.0, 1000.0);
+        double universal_rate = 0.05 / FriendRealNoiseRate(data, 1.0);
+        Utility::Rng().SetSeed(4172);
+        PhotonCount::Iterator iter = data.GetIterator();
+        iter.Next();
+        data.AddSparseNoise(universal_rate, iter);
+
+        double mean = 0.05 * data.NBins();
+        double nonzero_mean = (1 - Exp(-0.05)) * data.NBins();
+        Bool1D nonzero = data.AboveThreshold(iter, 0);
+        ASSERT_NEAR(mean, data.SumBins(iter), 5 * Sqrt(mean));
+        ASSERT_NEAR(nonzero_mean, count(nonzero.begin(), nonzero.end(), true), 5 * Sqrt(nonzero_mean));
+        while (iter.Next())
+            ASSERT_EQ(0, data.SumBins(iter));
+    }
+
+    /*
+     * Make sure tail noise keeps the expected number of bins above the threshold, leaves every other empty bin at zero,
+     * and subtracts the integer part of the mean from bins with signal.
+     */
+    TEST_F(DataStructuresTest, TailNoise)
+    {
+        PhotonCount data = PhotonCount(CopyParams(), 0.0, 1000.0);
+        double universal_rate = 2.5 / FriendRealNoiseRate(data, 1.0);
+        int threshold = PhotonCount::PoissonThreshold(2.5, 1.0);
+        PhotonCount::Iterator iter = data.GetIterator();
+        iter.Next();
+        FriendIncrementCell(data, 1000, iter.X(), iter.Y(), 7);
+        FriendSetTimeRange(data, 0.0, 999.95);
+        Utility::Rng().SetSeed(4173);
+        data.AddTailNoise(universal_rate, threshold, iter);
+
+        int n_above = 0;
+        Short1D signal = data.Signal(iter);
+        for (size_t i = 0; i < signal.size(); i++)
+        {
+            if (i == 7) ASSERT_GE(signal[i], 998);
+            else if (signal[i] > threshold) n_above++;
+            else ASSERT_EQ(0, signal[i]);
+        }
+        double tail_prob = 1.0;
+        for (int k = 0; k < threshold + 3; k++)
+            tail_prob -= Exp(-2.5) * Power(2.5, k) / Factorial(k);
+        double expected = tail_prob * (data.NBins() - 1);
+        ASSERT_NEAR(expected, n_above, 5 * Sqrt(expected));
+    }
+
     /*
      * Make sure the noise subtraction works correctly.
      */
@@ -745,6 +816,15 @@ namespace cherenkov_simulator
         ASSERT_EQ(15, data.FindThreshold(1e4, 3));
     }
 
+    /*
+     * Make sure the threshold found from a mean count per bin matches the one found from a noise rate.
+     */
+    TEST_F(DataStructuresTest, PoissonThreshold)
+    {
+        ASSERT_EQ(15, PhotonCount::PoissonThreshold(6.4, 3));
+        ASSERT_EQ(0, PhotonCount::PoissonThreshold(0.0, 3));
+    }
+
     /*
      * Test the Subset function.
      */
@@ -783,4 +863,167 @@ namespace cherenkov_simulator
         ASSERT_TRUE(Helper::ValuesEqual(0.35, data.Time(0), 1e-6));
         ASSERT_TRUE(Helper::ValuesEqual(0.95, data.Time(6), 1e-6));
     }
+
+    /*
+     * Checks that an event written to an event file is read back with the same signal and time range.
+     */
+    TEST_F(DataStructuresTest, EventRoundTrip)
+    {
+        PhotonCount data = CopySample();
+        data.Trim();
+        Shower shower = Shower(1e19, 1.4e5, TVector3(0, 0, 1e6), TVector3(0, 0, -1), 2e-6);
+        {
+            EventWriter writer = EventWriter("Events.evt");
+            writer.Write("1", shower, data);
+            writer.Write("2", shower, CopyEmpty());
+        }
+
+        string ident;
+        Shower read_shower;
+        PhotonCount read_data;
+        EventReader reader = EventReader("Events.evt");
+        ASSERT_TRUE(reader.Next(ident, read_shower, read_data));
+        ASSERT_EQ("1", ident);
+        ASSERT_EQ(shower.EnergyeV(), read_shower.EnergyeV());
+        ASSERT_EQ(shower.Elevation(), read_shower.Elevation());
+        ASSERT_TRUE(Helper::VectorsEqual(shower.Position(), read_shower.Position(), 1e-12));
+        ASSERT_EQ(data.NBins(), read_data.NBins());
+        ASSERT_EQ(data.Time(0), read_data.Time(0));
+        ASSERT_FALSE(read_data.Empty());
+        PhotonCount::Iterator iter = data.GetIterator();
+        while (iter.Next())
+        {
+            ASSERT_EQ(data.Signal(iter), read_data.Signal(iter));
+            ASSERT_EQ(data.SumBins(iter), read_data.SumBins(iter));
+        }
+
+        ASSERT_TRUE(reader.Next(ident, read_shower, read_data));
+        ASSERT_EQ("2", ident);
+        ASSERT_TRUE(read_data.Empty());
+        ASSERT_FALSE(reader.Next(ident, read_shower, read_data));
+    }
+
+    /*
+     * Checks that events in an indexed event file can be accessed out of order and copied back to a PhotonCount.
+     */
+    TEST_F(DataStructuresTest, IndexedEventAccess)
+    {
+        PhotonCount data = CopySample();
+        data.Trim();
+        Shower shower = Shower(1e19, 1.4e5, TVector3(0, 0, 1e6), TVector3(0, 0, -1), 2e-6);
+        IndexedEventWriter writer("Events.idx");
+        writer.Write("empty", shower, CopyEmpty());
+        writer.Write("sample", shower, data);
+        writer.Close();
+
+        IndexedEventFile file("Events.idx");
+        ASSERT_EQ(2, file.NEvents());
+        ASSERT_EQ(1, file.Find("sample"));
+        ASSERT_EQ(0, file.Find("empty"));
+        ASSERT_THROW(file.Find("missing"), out_of_range);
+        PhotonCountView view = file.Event(1);
+        ASSERT_EQ("sample", view.Ident());
+        ASSERT_EQ(shower.EnergyeV(), view.GetShower().EnergyeV());
+        ASSERT_EQ(7, view.NBins());
+        ASSERT_EQ(nullptr, view.Signal(0, 0));
+        ASSERT_EQ(14, view.SumBins(1, 1));
+        ASSERT_EQ(5, view.Signal(1, 1)[0]);
+
+        PhotonCount copy = view.ToPhotonCount();
+        PhotonCount::Iterator iter = data.GetIterator();
+        while (iter.Next())
+            ASSERT_EQ(data.Signal(iter), copy.Signal(iter));
+        ASSERT_EQ(0, file.Event(0).NFilled());
+    }
+
+    /*
+     * Checks that an index entry pointing too close to the end of the file is rejected rather than read past the end,
+     * and that a header whose index doesn't fit in the file is rejected even if its size would overflow.
+     */
+    TEST_F(DataStructuresTest, IndexedEventBounds)
+    {
+        Shower shower = Shower(1e19, 1.4e5, TVector3(0, 0, 1e6), TVector3(0, 0, -1), 2e-6);
+        IndexedEventWriter writer("Corrupt.idx");
+        writer.Write("empty", shower, CopyEmpty());
+        writer.Write("sample", shower, CopySample());
+        writer.Close();
+
+        // The index offset is the last field of the header, and the index is at the end of the file.
+        fstream corrupt = fstream("Corrupt.idx", ios::in | ios::out | ios::binary);
+        uint64_t index_offset;
+        corrupt.seekg(16);
+        corrupt.read((char*) &index_offset, sizeof(index_offset));
+        uint64_t bad_offset = index_offset - 8;
+        corrupt.seekp(index_offset + sizeof(uint64_t));
+        corrupt.write((const char*) &bad_offset, sizeof(bad_offset));
+        corrupt.close();
+
+        {
+            IndexedEventFile file("Corrupt.idx");
+            ASSERT_EQ(0, file.Event(0).NFilled());
+            ASSERT_EQ(1, file.Find("sample"));
+            ASSERT_THROW(file.Event(1), runtime_error);
+        }
+
+        // The number of events is the second field of the header.
+        corrupt = fstream("Corrupt.idx", ios::in | ios::out | ios::binary);
+        uint64_t n_events = numeric_limits<uint64_t>::max() / sizeof(uint64_t) + 1;
+        corrupt.seekp(8);
+        corrupt.write((const char*) &n_events, sizeof(n_events));
+        corrupt.close();
+        ASSERT_THROW(IndexedEventFile("Corrupt.idx"), runtime_error);
+    }
+
+    /*
+     * Checks that the zero-suppressed encoding reproduces every signal, including negative counts left by noise
+     * subtraction, both with and without delta coding.
+     */
+    TEST_F(DataStructuresTest, CodecRoundTrip)
+    {
+        PhotonCount data = CopySample();
+        FriendIncrementCell(data, -2, 2, 2, 0);
+        FriendIncrementCell(data, 300, 2, 1, 5);
+        FriendIncrementCell(data, 301, 2, 1, 6);
+        FriendIncrementCell(data, 301, 2, 1, 7);
+        for (bool delta : {false, true})
+        {
+            string buffer;
+            PhotonCodec::Encode(data, delta, buffer);
+            PhotonCount decoded = CopyEmpty();
+            PhotonCodec::Decode(buffer, decoded);
+            ASSERT_FALSE(decoded.Empty());
+            PhotonCount::Iterator iter = data.GetIterator();
+            while (iter.Next())
+            {
+                ASSERT_EQ(data.Signal(iter), decoded.Signal(iter));
+                ASSERT_EQ(data.SumBins(iter), decoded.SumBins(iter));
+            }
+        }
+    }
+
+    /*
+     * Checks that the streaming decoder reports each nonzero pixel with the span between its first and last nonzero
+     * bins.
+     */
+    TEST_F(DataStructuresTest, SignalDecoderSpans)
+    {
+        string buffer;
+        PhotonCodec::Encode(CopySample(), false, buffer);
+        SignalDecoder decoder = SignalDecoder(buffer.data(), buffer.data() + buffer.size());
+        ASSERT_EQ(4, decoder.Size());
+        ASSERT_EQ(10, decoder.NBins());
+        ASSERT_EQ(2, decoder.NFilled());
+
+        size_t pixel, first_bin;
+        Short1D span;
+        ASSERT_TRUE(decoder.Next(pixel, first_bin, span));
+        ASSERT_EQ(2, pixel);
+        ASSERT_EQ(7, first_bin);
+        ASSERT_EQ(Short1D({1}), span);
+        ASSERT_TRUE(decoder.Next(pixel, first_bin, span));
+        ASSERT_EQ(5, pixel);
+        ASSERT_EQ(3, first_bin);
+        ASSERT_EQ(Short1D({5, 1, 0, 0, 0, 0, 8}), span);
+        ASSERT_FALSE(decoder.Next(pixel, first_bin, span));
+    }
 }
@@ -0,0 +1,195 @@
+// MonteCarloTest.cpp
+//
+// Author: Matthew Dutson
+//
+// Tests of MonteCarlo.h
+
+#include <fstream>
+#include <set>
+#include <gtest/gtest.h>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/xml_parser.hpp>
+#include <Math/MinimizerOptions.h>
+#include <TF1.h>
+#include <TFile.h>
+#include <TList.h>
+#include <TROOT.h>
+#include <TTree.h>
+
+#include "MonteCarlo.h"
+
+using namespace std;
+using namespace boost::property_tree;
+
+namespace cherenkov_simulator
+{
+    class MonteCarloTest : public ::testing::Test
+    {
+    protected:
+
+        ptree config;
+
+        /*
+         * Sets up a configuration which simulates small, bright showers quickly and writes no diagnostics.
+         */
+        virtual void SetUp()
+        {
+            ROOT::EnableThreadSafety();
+            TF1::DefaultAddToGlobalList(false);
+            ROOT::Math::MinimizerOptions::SetDefaultMinimizer("Minuit2");
+            config = Utility::ParseXMLFile("../Config.xml").get_child("config");
+            config.put("simulation.ckpt_every", 0);
+            config.put("simulation.diagnostics", "none");
+            config.put("simulation.results_tree", false);
+            config.put("simulation.flor_thin", 100);
+            config.put("simulation.chkv_thin", 100);
+            config.put("monte_carlo.energy_min", 3e18);
+            config.put("monte_carlo.energy_max", 1e19);
+            config.put("monte_carlo.impact_max", 1e6);
+        }
+
+        /*
+         * Returns the full contents of a file.
+         */
+        static string ReadFile(string filename)
+        {
+            ifstream fin = ifstream(filename);
+            return string(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+        }
+
+        /*
+         * Returns the names of the objects in a ROOT file, followed by the number of rows in its results tree.
+         */
+        static set<string> ReadKeys(string filename)
+        {
+            TFile file(filename.c_str(), "READ");
+            set<string> keys = set<string>();
+            TIter next(file.GetListOfKeys());
+            while (TObject* key = next())
+                keys.insert(key->GetName());
+            TTree* tree = (TTree*) file.Get("results");
+            keys.insert("results:" + to_string(tree == nullptr ? -1 : tree->GetEntries()));
+            return keys;
+        }
+    };
+
+    TEST_F(MonteCarloTest, CheckpointRoundTrip)
+    {
+        /*
+         * Make sure a checkpoint is read back exactly as it was written.
+         */
+        MonteCarlo::Checkpoint ckpt = MonteCarlo::Checkpoint();
+        ckpt.next_id = 42;
+        ckpt.n_untriggered = 17;
+        ckpt.start_seed = 123456789;
+        ckpt.csv_offset = 4096;
+        ckpt.stratum_attempts = {12, 30};
+        ckpt.stratum_stats = vector<RunningStat>(2);
+        ckpt.stratum_stats[1].Add(0.1);
+        ckpt.stratum_stats[1].Add(-0.3, 2.5);
+        ckpt.Write("Checkpoint.xml");
+
+        MonteCarlo::Checkpoint read = MonteCarlo::Checkpoint::Read("Checkpoint.xml");
+        EXPECT_EQ(ckpt.next_id, read.next_id);
+        EXPECT_EQ(ckpt.n_untriggered, read.n_untriggered);
+        EXPECT_EQ(ckpt.start_seed, read.start_seed);
+        EXPECT_EQ(ckpt.csv_offset, read.csv_offset);
+        EXPECT_EQ(ckpt.stratum_attempts, read.stratum_attempts);
+        ASSERT_EQ(2u, read.stratum_stats.size());
+        EXPECT_EQ(0, read.stratum_stats[0].Count());
+        EXPECT_EQ(ckpt.stratum_stats[1].Mean(), read.stratum_stats[1].Mean());
+        EXPECT_EQ(ckpt.stratum_stats[1].StdError(), read.stratum_stats[1].StdError());
+    }
+
+    TEST_F(MonteCarloTest, DiagnosticLevel)
+    {
+        /*
+         * Make sure only selected showers get diagnostics, and that identifiers which aren't valid shower IDs, including
+         * numbers too large for an int, get the configured level.
+         */
+        config.put("simulation.diagnostics", "summary");
+        config.put("simulation.diag_every", 5);
+        MonteCarlo monte_carlo = MonteCarlo(config);
+        EXPECT_EQ(MonteCarlo::DiagLevel::summary, monte_carlo.DiagnosticLevel("10"));
+        EXPECT_EQ(MonteCarlo::DiagLevel::none, monte_carlo.DiagnosticLevel("11"));
+        EXPECT_EQ(MonteCarlo::DiagLevel::summary, monte_carlo.DiagnosticLevel("sample"));
+        EXPECT_EQ(MonteCarlo::DiagLevel::summary, monte_carlo.DiagnosticLevel("99999999999"));
+    }
+
+    TEST_F(MonteCarloTest, ThreadCountDeterminism)
+    {
+        /*
+         * Make sure a Monte Carlo run writes the same rows whether showers are simulated on one thread or several.
+         * Enough showers are run that the fits of several showers overlap.
+         */
+        config.put("simulation.n_showers", 12);
+        vector<string> outputs = vector<string>();
+        for (int n_threads : {1, 3})
+        {
+            config.put("simulation.n_threads", n_threads);
+            string output_file = "Threads" + to_string(n_threads);
+            gRandom->SetSeed(4357);
+            MonteCarlo(config).PerformMonteCarlo(output_file);
+            outputs.push_back(ReadFile(output_file + ".csv"));
+        }
+        EXPECT_FALSE(outputs[0].empty());
+        EXPECT_EQ(outputs[0], outputs[1]);
+    }
+
+    TEST_F(MonteCarloTest, SweepMatchesSeparateRuns)
+    {
+        /*
+         * Make sure each configuration of a sweep writes the same rows as a separate run, both for overlays which share
+         * their simulation and for one which doesn't. One of the shared overlays rejects showers by its own
+         * pre-trigger margin.
+         */
+        config.put("simulation.n_showers", 3);
+        config.put("simulation.pre_trigger", 0);
+        vector<string> overlays = {"SweepLow.xml", "SweepHigh.xml", "SweepThin.xml", "SweepPre.xml"};
+        vector<ptree> overlay_trees = vector<ptree>(4);
+        overlay_trees[0].put("config.triggering.trigr_thresh", 5.0);
+        overlay_trees[1].put("config.triggering.trigr_thresh", 7.0);
+        overlay_trees[2].put("config.simulation.flor_thin", 200);
+        overlay_trees[3].put("config.simulation.pre_trigger", 2.0);
+        for (int i = 0; i < 4; i++)
+            write_xml(overlays[i], overlay_trees[i]);
+        gRandom->SetSeed(4357);
+        MonteCarlo::PerformSweep(config, overlays, "Sweep");
+
+        for (int i = 0; i < 4; i++)
+        {
+            ptree overlaid = config;
+            Utility::ApplyOverlay(overlaid, overlay_trees[i].get_child("config"));
+            gRandom->SetSeed(4357);
+            MonteCarlo(overlaid).PerformMonteCarlo("Separate");
+            string name = overlays[i].substr(0, overlays[i].find('.'));
+            EXPECT_EQ(ReadFile("Sweep_" + name + ".csv"), ReadFile("Separate.csv"));
+        }
+    }
+
+    TEST_F(MonteCarloTest, ResumeMatchesUninterrupted)
+    {
+        /*
+         * Make sure a run which is interrupted and then resumed from its last checkpoint writes the same CSV rows and
+         * ROOT objects as one which wasn't interrupted. The interrupted run writes a shower after its last checkpoint,
+         * which has to be removed from both files when resuming.
+         */
+        config.put("simulation.diagnostics", "summary");
+        config.put("simulation.diag_every", 1);
+        config.put("simulation.results_tree", true);
+        config.put("simulation.n_showers", 5);
+        gRandom->SetSeed(4357);
+        MonteCarlo(config).PerformMonteCarlo("Uninterrupted");
+
+        config.put("simulation.ckpt_every", 2);
+        config.put("simulation.n_showers", 3);
+        gRandom->SetSeed(4357);
+        MonteCarlo(config).PerformMonteCarlo("Resumed");
+        config.put("simulation.n_showers", 5);
+        gRandom->SetSeed(1);
+        MonteCarlo(config).PerformMonteCarlo("Resumed", true);
+
+        EXPECT_EQ(ReadFile("Uninterrupted.csv"), ReadFile("Resumed.csv"));
+        EXPECT_EQ(ReadKeys("Uninterrupted.root"), ReadKeys("Resumed.root"));
+    }
+}
@@ -0,0 +1,77 @@
+// OutputWriterTest.cpp
+//
+// Author: Matthew Dutson
+//
+// Tests of OutputWriter.h
+
+#include <fstream>
+#include <gtest/gtest.h>
+
+#include "OutputWriter.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    /*
+     * A ROOT object which can't be written, used to make a task fail on the writer thread.
+     */
+    class UnwritableObject : public TObject
+    {
+    public:
+
+        int Write(const char* name = nullptr, int option = 0, int bufsize = 0)
+        {
+            throw runtime_error("The object " + string(name) + " can't be written.");
+        }
+
+        int Write(const char* name = nullptr, int option = 0, int bufsize = 0) const
+        {
+            throw runtime_error("The object " + string(name) + " can't be written.");
+        }
+    };
+
+    TEST(OutputWriterTest, RowOrder)
+    {
+        /*
+         * Make sure rows queued from the simulation thread are all written, in order, once the writer is synced.
+         */
+        OutputWriter writer("OutputWriter", false, 1, 4);
+        string expected = string();
+        for (int i = 0; i < 1000; i++)
+        {
+            writer.WriteLine(to_string(i));
+            expected += to_string(i) + "\n";
+        }
+        EXPECT_EQ((long) expected.size(), writer.Sync());
+        writer.Close();
+
+        ifstream fin = ifstream("OutputWriter.csv");
+        string written = string(istreambuf_iterator<char>(fin), istreambuf_iterator<char>());
+        EXPECT_EQ(expected, written);
+    }
+
+    TEST(OutputWriterTest, TaskError)
+    {
+        /*
+         * Make sure an exception thrown on the writer thread is rethrown to the caller once, and that the writer keeps
+         * working afterwards.
+         */
+        OutputWriter writer("OutputWriter", false, 1, 4);
+        PlotList plots = PlotList();
+        plots.emplace_back("1_bad", unique_ptr<TObject>(new UnwritableObject()));
+        writer.WritePlots(move(plots));
+        try
+        {
+            writer.Sync();
+            FAIL() << "Exception not thrown";
+        }
+        catch (runtime_error& err)
+        {
+            EXPECT_EQ(string("The object 1_bad can't be written."), err.what());
+        }
+        writer.WriteLine("0");
+        EXPECT_EQ(2, writer.Sync());
+        writer.Close();
+    }
+}
@@ -0,0 +1,41 @@
+// ProfilerTest.cpp
+//
+// Author: Matthew Dutson
+//
+// Tests of Profiler.h
+
+#include <chrono>
+#include <thread>
+#include <gtest/gtest.h>
+
+#include "Profiler.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    TEST(ProfilerTest, NestedStageTimers)
+    {
+        /*
+         * Make sure time spent in a nested stage isn't also charged to the enclosing stage.
+         */
+        ShowerProfile profile = ShowerProfile();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        {
+            StageTimer outer(&profile, ShowerProfile::fluorescence);
+            this_thread::sleep_for(chrono::milliseconds(20));
+            {
+                StageTimer inner(&profile, ShowerProfile::optics);
+                EXPECT_EQ(ShowerProfile::optics, profile.Current());
+                this_thread::sleep_for(chrono::milliseconds(20));
+            }
+            EXPECT_EQ(ShowerProfile::fluorescence, profile.Current());
+        }
+        double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        EXPECT_EQ(-1, profile.Current());
+        EXPECT_GE(profile.seconds[ShowerProfile::fluorescence], 0.02);
+        EXPECT_GE(profile.seconds[ShowerProfile::optics], 0.02);
+        EXPECT_LE(profile.seconds[ShowerProfile::fluorescence] + profile.seconds[ShowerProfile::optics], elapsed);
+        EXPECT_EQ(0, profile.seconds[ShowerProfile::noise]);
+    }
+}
@@ -0,0 +1,77 @@
+// ReconstructorTest.cpp
+//
+// Author: Matthew Dutson
+//
+// Tests of Reconstructor.h
+
+#include <cstdio>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <boost/property_tree/ptree.hpp>
+#include <TMath.h>
+
+#include "Reconstructor.h"
+#include "Simulator.h"
+
+using namespace std;
+using namespace boost::property_tree;
+
+namespace cherenkov_simulator
+{
+    TEST(ReconstructorTest, NoiseMap)
+    {
+        /*
+         * Make sure a uniform noise map sets the trigger threshold of every pixel, and that a map with the wrong
+         * number of rates is rejected.
+         */
+        ptree config = Utility::ParseXMLFile("../Config.xml").get_child("config");
+        config.put("detector.n_pixels", 4);
+        config.put("surroundings.noise_map", "NoiseMap.txt");
+        ofstream map_out = ofstream("NoiseMap.txt");
+        map_out << "# Ten times the usual sky background" << endl;
+        for (int i = 0; i < 4; i++)
+            map_out << 10 * glob_sky_noise << " " << 10 * glob_sky_noise << " " << 10 * glob_sky_noise << " "
+                    << 10 * glob_sky_noise << endl;
+        map_out.close();
+
+        PhotonCount::Params params = Simulator::MakeCountParams(config);
+        double stop_radius = config.get<double>("detector.mirror_radius") / config.get<double>("detector.f_number") / 4;
+        double rate = TMath::Pi() * stop_radius * stop_radius * 10 * glob_sky_noise;
+        double mean = rate * params.ang_size * params.ang_size * params.bin_size;
+        double expected = PhotonCount::PoissonThreshold(mean, config.get<double>("triggering.trigr_thresh")) - mean;
+        EXPECT_NEAR(expected, Reconstructor(config).TriggerSignal(params), 1e-9);
+
+        map_out = ofstream("NoiseMap.txt");
+        map_out << glob_sky_noise << endl;
+        map_out.close();
+        try
+        {
+            Reconstructor reconstructor = Reconstructor(config);
+            FAIL() << "Exception not thrown";
+        }
+        catch (runtime_error& err)
+        {
+            EXPECT_EQ(string("The noise map NoiseMap.txt must contain 4 rows of 4 rates."), err.what());
+        }
+        remove("NoiseMap.txt");
+    }
+
+    TEST(ReconstructorTest, TableMismatch)
+    {
+        /*
+         * Make sure noise isn't added with thresholds computed for a different pixel array or time bin size.
+         */
+        ptree config = Utility::ParseXMLFile("../Config.xml").get_child("config");
+        config.put("detector.n_pixels", 4);
+        Reconstructor reconstructor = Reconstructor(config);
+        PhotonCount::Params params = Simulator::MakeCountParams(config);
+        params.bin_size *= 2;
+        PhotonCount coarse = PhotonCount(params, 0.0, 10 * params.bin_size);
+        EXPECT_THROW(reconstructor.AddNoise(coarse), invalid_argument);
+
+        params = Simulator::MakeCountParams(config);
+        params.n_pixels = 6;
+        PhotonCount larger = PhotonCount(params, 0.0, 10 * params.bin_size);
+        EXPECT_THROW(reconstructor.AddNoise(larger), invalid_argument);
+    }
+}
@@ -0,0 +1,43 @@
+// ResultPlotterTest.cpp
+//
+// Author: Matthew Dutson
+//
+// Tests of ResultPlotter.h
+
+#include <gtest/gtest.h>
+
+#include "ResultPlotter.h"
+
+using namespace std;
+
+namespace cherenkov_simulator
+{
+    TEST(ResultPlotterTest, ParseLine)
+    {
+        /*
+         * Make sure rows of the CSV file are parsed into the same columns as the results tree, and headers are skipped.
+         */
+        ResultRow row = ResultRow();
+        EXPECT_FALSE(ResultPlotter::ParseLine("Seed,ID,Energy,Angle(deg),Impact(km),Ground(km), Triggered,"
+                                              "Angle(deg),Impact(km),Ground(km),Cherenkov,Angle(deg),Impact(km),"
+                                              "Ground(km)", row));
+        EXPECT_FALSE(ResultPlotter::ParseLine("1,2,3", row));
+        ASSERT_TRUE(ResultPlotter::ParseLine("4357,12,1.5e+19,84.2,10.5,12.1,1,80.1,9.8,11.3,1,83.9,10.4,12.0", row));
+        EXPECT_EQ(4357u, row.seed);
+        EXPECT_EQ(12, row.id);
+        EXPECT_DOUBLE_EQ(1.5e19, row.energy);
+        EXPECT_DOUBLE_EQ(10.5, row.im);
+        EXPECT_EQ(1, row.trig);
+        EXPECT_DOUBLE_EQ(80.1, row.mono_psi);
+        EXPECT_EQ(1, row.chkv);
+        EXPECT_DOUBLE_EQ(12.0, row.chkv_gnd);
+        EXPECT_DOUBLE_EQ(1.0, row.weight);
+        ASSERT_TRUE(ResultPlotter::ParseLine("4357,12,1.5e+19,84.2,10.5,12.1,1,80.1,9.8,11.3,1,83.9,10.4,12.0,"
+                                             "0.25", row));
+        EXPECT_DOUBLE_EQ(0.25, row.weight);
+        EXPECT_EQ(0, row.realization);
+        ASSERT_TRUE(ResultPlotter::ParseLine("4357,12,1.5e+19,84.2,10.5,12.1,1,80.1,9.8,11.3,1,83.9,10.4,12.0,"
+                                             "0.25,3", row));
+        EXPECT_EQ(3, row.realization);
+    }
+}
@@ -0,0 +1,83 @@
+// StatisticsTest.cpp
+//
+// Author: Matthew Dutson
+//
+// Tests of Statistics.h
+
+#include <gtest/gtest.h>
+#include <boost/property_tree/ptree.hpp>
+
+#include "Statistics.h"
+#include "Utility.h"
+
+using namespace std;
+using namespace boost::property_tree;
+
+namespace cherenkov_simulator
+{
+    TEST(StatisticsTest, RunningStat)
+    {
+        /*
+         * Make sure the running mean and standard error match a direct calculation, and that merging two accumulators
+         * is the same as adding every value to one.
+         */
+        double values[] = {2.0, 4.0, 4.0, 4.0, 5.0, 5.0, 7.0, 9.0};
+        RunningStat all = RunningStat();
+        RunningStat first = RunningStat();
+        RunningStat second = RunningStat();
+        for (int i = 0; i < 8; i++)
+        {
+            all.Add(values[i]);
+            (i < 3 ? first : second).Add(values[i]);
+        }
+        EXPECT_EQ(8, all.Count());
+        EXPECT_DOUBLE_EQ(5.0, all.Mean());
+        EXPECT_DOUBLE_EQ(32.0 / 7.0, all.Variance());
+        EXPECT_DOUBLE_EQ(sqrt(32.0 / 7.0 / 8.0), all.StdError());
+
+        first.Add(second);
+        EXPECT_EQ(all.Count(), first.Count());
+        EXPECT_DOUBLE_EQ(all.Mean(), first.Mean());
+        EXPECT_DOUBLE_EQ(all.Variance(), first.Variance());
+
+        // A value with weight two counts like the same value added twice, apart from the effective count.
+        RunningStat weighted = RunningStat();
+        weighted.Add(1.0, 2.0);
+        weighted.Add(4.0);
+        EXPECT_DOUBLE_EQ(2.0, weighted.Mean());
+        EXPECT_TRUE(std::isinf(RunningStat().StdError()));
+    }
+
+    TEST(StatisticsTest, ConvergenceMonitor)
+    {
+        /*
+         * Make sure the monitor only reports convergence once there are enough showers and every monitored interval is
+         * narrow enough, and that unmonitored quantities are ignored.
+         */
+        ptree config = Utility::ParseXMLFile("../Config.xml").get_child("config");
+        config.put("convergence.min_showers", 20);
+        config.put("convergence.trig_toler", 0.5);
+        config.put("convergence.mono_im_toler", 0.05);
+        config.put("convergence.mono_psi_toler", 0.0);
+        config.put("convergence.chkv_im_toler", 0.0);
+        config.put("convergence.chkv_psi_toler", 0.0);
+        ConvergenceMonitor monitor = ConvergenceMonitor(config);
+
+        vector<RunningStat> stats = ConvergenceMonitor::EmptyStats();
+        for (int i = 0; i < 1000 && !monitor.Converged(stats); i++)
+        {
+            ResultRow row = ResultRow();
+            row.trig = i % 2;
+            row.im = 10.0;
+            row.mono_im = i % 4 == 1 ? 10.1 : 9.9;
+            row.mono_psi = 50.0 * (i % 3);
+            ConvergenceMonitor::Add(stats, row);
+        }
+        EXPECT_TRUE(monitor.Converged(stats));
+        EXPECT_GE(stats[ConvergenceMonitor::mono_im].Count(), 20);
+        EXPECT_LT(stats[ConvergenceMonitor::mono_im].Count(), 100);
+        EXPECT_EQ(0, stats[ConvergenceMonitor::chkv_im].Count());
+        EXPECT_NEAR(0.5, stats[ConvergenceMonitor::trig_eff].Mean(), 0.01);
+        EXPECT_NEAR(0.0, stats[ConvergenceMonitor::mono_im].Mean(), 1e-3);
+    }
+}
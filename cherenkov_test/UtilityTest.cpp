@@ -31,4 +31,83 @@ namespace cherenkov_simulator
         }
         power_histo.Write("power_histo");
     }
-}
\ No newline at end of file
+
+    TEST(MiscellaneousTest, DeriveSeed)
+    {
+        /*
+         * Make sure derived seeds depend on both inputs and are never zero.
+         */
+        EXPECT_EQ(Utility::DeriveSeed(4357, 12), Utility::DeriveSeed(4357, 12));
+        EXPECT_NE(Utility::DeriveSeed(4357, 12), Utility::DeriveSeed(4357, 13));
+        EXPECT_NE(Utility::DeriveSeed(4357, 12), Utility::DeriveSeed(4358, 12));
+        for (long i = 0; i < 100000; i++)
+            EXPECT_NE(0u, Utility::DeriveSeed(0, i));
+    }
+
+    TEST(MiscellaneousTest, HaltonStrata)
+    {
+        /*
+         * Make sure every aligned block of b^k consecutive Halton points puts exactly one point in each of the b^k
+         * strata of (0, 1), for the bases of the first three dimensions.
+         */
+        int bases[] = {2, 3, 5};
+        for (int dim = 0; dim < 3; dim++)
+        {
+            int n_strata = bases[dim] * bases[dim] * bases[dim];
+            vector<int> counts = vector<int>(n_strata, 0);
+            for (long index = 2 * n_strata; index < 3 * n_strata; index++)
+            {
+                double value = Utility::Halton(index, dim, 4357);
+                ASSERT_GT(value, 0.0);
+                ASSERT_LT(value, 1.0);
+                counts[(int) (value * n_strata)]++;
+            }
+            for (int count : counts)
+                EXPECT_EQ(1, count);
+        }
+        EXPECT_EQ(Utility::Halton(12, 4, 4357), Utility::Halton(12, 4, 4357));
+        EXPECT_NE(Utility::Halton(12, 4, 4357), Utility::Halton(12, 4, 4358));
+    }
+
+    TEST(MiscellaneousTest, ProposalWeights)
+    {
+        /*
+         * Make sure weights from a proposal distribution average to one, so weighted sums are unbiased.
+         */
+        Utility::Rng().SetSeed(4357);
+        const int n_draws = 100000;
+        double power_sum = 0;
+        double cosine_sum = 0;
+        for (int i = 0; i < n_draws; i++)
+        {
+            double value = Utility::RandPower(1, 10, -2);
+            power_sum += Utility::PowerDensity(value, 1, 10, -1) / Utility::PowerDensity(value, 1, 10, -2);
+            double angle = Utility::RandCosine(0.5);
+            cosine_sum += Utility::CosineDensity(angle) / Utility::CosineDensity(angle, 0.5);
+        }
+        EXPECT_NEAR(1.0, power_sum / n_draws, 0.02);
+        EXPECT_NEAR(1.0, cosine_sum / n_draws, 0.02);
+    }
+
+    TEST(MiscellaneousTest, ApplyOverlay)
+    {
+        /*
+         * Make sure an overlay replaces only the values it contains, and that attributes don't become values.
+         */
+        ptree config = ptree();
+        config.put("simulation.flor_thin", 1);
+        config.put("simulation.chkv_thin", 1);
+        config.put("simulation.flor_thin.<xmlattr>.unit", "null");
+        config.put("detector.n_pixels", 300);
+
+        ptree overlay = ptree();
+        overlay.put("simulation.flor_thin", 10);
+        overlay.put("simulation.flor_thin.<xmlattr>.note", "Faster");
+        Utility::ApplyOverlay(config, overlay);
+
+        EXPECT_EQ(10, config.get<int>("simulation.flor_thin"));
+        EXPECT_EQ(1, config.get<int>("simulation.chkv_thin"));
+        EXPECT_EQ(300, config.get<int>("detector.n_pixels"));
+        EXPECT_EQ("null", config.get<string>("simulation.flor_thin.<xmlattr>.unit"));
+    }
+}
@@ -12,7 +12,7 @@ struct Params
     const char* mono_strn;
     const char* chkv_strn;
     const char* canv_name;
-    const char* filter = "chkv > 0";
+    const char* filter = "weight * (chkv > 0)";
     int n_bins;
     double min;
     double max;
@@ -75,11 +75,39 @@ void MakeDoubleProfile(TTree& tree, Params par, const char* x_lab, const char* y
 
 }
 
-void PlotResults(const char* csv_file)
+// Returns the branch descriptor of a CSV file, based on the number of columns in its header. Files written before
+// showers were weighted have no weight or realization columns, and profiled runs add timing columns at the end.
+string CSVDescriptor(const char* csv_file)
 {
-    TTree tree;
-    const char* branch_desc = "seed:id:energy:psi:im:gnd:trig:mono_psi:mono_im:mono_gnd:chkv:chkv_psi:chkv_im:chkv_gnd";
-    tree.ReadFile(csv_file, branch_desc, ',');
+    const char* names[] = {"seed", "id", "energy", "psi", "im", "gnd", "trig", "mono_psi", "mono_im", "mono_gnd",
+                           "chkv", "chkv_psi", "chkv_im", "chkv_gnd", "weight", "realization"};
+    ifstream fin(csv_file);
+    string header;
+    getline(fin, header);
+    size_t n_columns = count(header.begin(), header.end(), ',') + 1;
+    string desc;
+    for (size_t i = 0; i < n_columns; i++)
+    {
+        if (i > 0) desc += ":";
+        desc += i < 16 ? string(names[i]) : "extra" + to_string(i - 16);
+    }
+    return desc;
+}
+
+// Accepts either a CSV file or ROOT files containing a "results" tree. Wildcards may be used to chain several ROOT
+// files, in which case they don't need to be merged first. Results without weights are given a weight of one and a
+// realization of zero.
+void PlotResults(const char* input_file)
+{
+    string input = input_file;
+    TChain chain("results");
+    TTree csv_tree;
+    bool is_root = input.size() > 5 && input.substr(input.size() - 5) == ".root";
+    if (is_root) chain.Add(input_file);
+    else csv_tree.ReadFile(input_file, CSVDescriptor(input_file).c_str(), ',');
+    TTree& tree = is_root ? (TTree&) chain : csv_tree;
+    if (tree.GetBranch("weight") == nullptr) tree.SetAlias("weight", "1");
+    if (tree.GetBranch("realization") == nullptr) tree.SetAlias("realization", "0");
     TFile file("Results.root", "RECREATE");
     Params par;
 